@@ -20,6 +20,10 @@ class Bit : public Swappable<Bit>{ public:
 	template<typename O = bool> 
 	O reveal(int party = PUBLIC) const;
 
+	// Reveals length bits at once, so that the protocol can send them
+	// together instead of exchanging a message per bit
+	static void reveal(bool* out, const Bit* bits, int length, int party = PUBLIC);
+
 	Bit operator!=(const Bit& rhs) const; 
 	Bit operator==(const Bit& rhs) const;
 	Bit operator &(const Bit& rhs) const;  
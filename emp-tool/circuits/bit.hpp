@@ -18,6 +18,14 @@ inline O Bit::reveal(int party) const {
 	return res;
 }
 
+inline void Bit::reveal(bool* out, const Bit* bits, int length, int party) {
+	Label* labels = new Label[length];
+	for(int i = 0; i < length; ++i)
+		labels[i] = bits[i].bit0;
+	ProtocolExecution::prot_exec->reveal(out, party, labels, length);
+	delete[] labels;
+}
+
 template<>
 inline string Bit::reveal<string>(int party) const {
 	bool res;
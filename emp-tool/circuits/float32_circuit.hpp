@@ -7,10 +7,12 @@ inline Float32::Float32(float input, int party) {
 
 template<>
 inline string Float32::reveal<string>(int party) const {
+	bool b[FLOAT_LEN];
+	Bit::reveal(b, value.data(), FLOAT_LEN, party);
 	int out = 0;
 	for(int i = FLOAT_LEN-1; i >= 0; --i) {
 		out <<= 1;
-		out += value[i].reveal<bool>(party);
+		out += b[i];
 	}
 	float *fp = (float*)(&out);
 	return std::to_string(*fp);
@@ -18,10 +20,12 @@ inline string Float32::reveal<string>(int party) const {
 
 template<>
 inline double Float32::reveal<double>(int party) const {
+	bool b[FLOAT_LEN];
+	Bit::reveal(b, value.data(), FLOAT_LEN, party);
 	int out = 0;
 	for(int i = FLOAT_LEN-1; i >= 0; --i) {
 		out <<= 1;
-		out += value[i].reveal<bool>(party);
+		out += b[i];
 	}
 	float *fp = (float*)(&out);
 	return (double)*fp;
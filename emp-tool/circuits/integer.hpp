@@ -130,7 +130,22 @@ inline void init(Bit * bits, const bool* b, int length, int party) {
 		for(int i = 0; i < length; ++i)
 			bits[i].bit0 = b[i] ? one : zero;
 	}
+	else if (party == ALICE) {
+		// The garbler's input is fed in one call, so that the protocol can
+		// send all its labels in one message
+		Label* label0 = new Label[length];
+		Label* label1 = new Label[length];
+		ProtocolExecution::prot_exec->feed(label0, label1, party, b, length);
+		for(int i = 0; i < length; ++i) {
+			bits[i].bit0 = label0[i];
+			bits[i].bit1 = label1[i];
+		}
+		delete[] label0;
+		delete[] label1;
+	}
 	else {
+        // Batched OTs update the evaluator's labels later through pointers,
+        // so they are fed in place
         for(int i = 0; i < length; i++)
             ProtocolExecution::prot_exec->feed(&(bits[i].bit0), &(bits[i].bit1), party, b + i, 1); 
 	}
@@ -171,8 +186,7 @@ inline const Bit &Integer::operator[](int index) const {
 template<>
 inline string Integer::reveal<string>(int party) const {
 	bool * b = new bool[length];
-    for(int i = 0; i < length; i++)
-        ProtocolExecution::prot_exec->reveal(b + i, party, &(bits[i].bit0), 1); 
+	Bit::reveal(b, bits, length, party);
 	string bin="";
 	for(int i = length-1; i >= 0; --i)
 		bin += (b[i]? '1':'0');
@@ -196,8 +210,7 @@ template<>
 inline uint32_t Integer::reveal<uint32_t>(int party) const {
 	std::bitset<32> bs;
 	bool b[32];
-    for(int i = 0; i < 32; i++)
-        ProtocolExecution::prot_exec->reveal(b + i, party, &(bits[i].bit0), 1); 
+	Bit::reveal(b, bits, 32, party);
 	for (int i = 0; i < 32; ++i)
 		bs.set(i, b[i]);
 	return bs.to_ulong();
@@ -207,8 +220,7 @@ template<>
 inline uint64_t Integer::reveal<uint64_t>(int party) const {
 	std::bitset<64> bs;
 	bool b[64];
-    for(int i = 0; i < 64; i++)
-        ProtocolExecution::prot_exec->reveal(b + i, party, &(bits[i].bit0), 1); 
+	Bit::reveal(b, bits, 64, party);
 	for (int i = 0; i < 64; ++i)
 		bs.set(i, b[i]);
 	return bs.to_ullong();
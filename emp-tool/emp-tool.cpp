@@ -1,5 +1,10 @@
 #include "emp-tool/execution/circuit_execution.h"
 #include "emp-tool/execution/protocol_execution.h"
 
+#ifndef THREADING
 emp::ProtocolExecution* emp::ProtocolExecution::prot_exec = nullptr;
 emp::CircuitExecution* emp::CircuitExecution::circ_exec = nullptr;
+#else
+__thread emp::ProtocolExecution* emp::ProtocolExecution::prot_exec = nullptr;
+__thread emp::CircuitExecution* emp::CircuitExecution::circ_exec = nullptr;
+#endif
@@ -1,4 +1,9 @@
+#include "emp-tool/io/io-channel.h"
 #include "emp-tool/io/net-io.h"
+#include "emp-tool/io/shm-io.h"
+#include "emp-tool/io/uring-io.h"
+#include "emp-tool/io/wan-io.h"
+#include "emp-tool/io/record-io.h"
 
 #include "emp-tool/circuits/batcher.h"
 #include "emp-tool/circuits/bit.h"
@@ -18,3 +23,4 @@
 
 #include "emp-tool/execution/circuit_execution.h"
 #include "emp-tool/execution/protocol_execution.h"
+#include "emp-tool/execution/clear_execution.h"
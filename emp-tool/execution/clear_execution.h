@@ -0,0 +1,227 @@
+#ifndef CLEAR_EXECUTION_H__
+#define CLEAR_EXECUTION_H__
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dlfcn.h>
+#include <execinfo.h>
+#include <cxxabi.h>
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "emp-tool/utils/block.h"
+#include "emp-tool/execution/circuit_execution.h"
+#include "emp-tool/execution/protocol_execution.h"
+
+// Frames of the stack searched for the call site of a gate
+#define CLEAR_SITE_DEPTH 16
+
+namespace emp {
+struct GateCount {
+    uint64_t and_gates = 0;
+    uint64_t xor_gates = 0;
+    uint64_t not_gates = 0;
+
+    uint64_t total() const {
+        return and_gates + xor_gates + not_gates;
+    }
+};
+
+// Evaluates circuits on clear bits in one process, to check that they compute
+// the right function and to count their gates without running a protocol.
+// Bits are sliced: the label of a bit holds a 64-bit word, copied into each
+// of its four 64-bit lanes, whose bit k is the value of the bit in instance
+// k, so every gate runs 64 instances at once. Gates with public inputs are
+// counted like any other gate. With count_sites, gates are also counted per
+// call site: the first return address on the stack outside of Bit's own
+// functions, which lies in the function that built the circuit from Bit
+// operations, such as an Integer operator. Sites are only told apart from
+// Bit's functions if the binary exports its symbols (-rdynamic).
+class ClearCircuitExecution: public CircuitExecution {
+public:
+    GateCount count;
+    bool count_sites = true;
+    std::unordered_map<void*, GateCount> sites;
+    std::unordered_map<void*, bool> bit_frames;
+
+    static Label label(uint64_t word) {
+        block b = makeBlock(word, word);
+        return Label(b, b);
+    }
+
+    static uint64_t word(const Label& a) {
+        return ((const uint64_t*) &a)[0];
+    }
+
+    Label public_label(bool b) override {
+        return b ? one_label() : zero_label();
+    }
+
+    // Gates and site are not inlined, so that the caller of the gate is the
+    // third frame of site
+    __attribute__((noinline))
+    void and_gate(Label& c0, Label& c1, const Label& a0, const Label& a1,
+            const Label& b0, const Label& b1) override {
+        count.and_gates++;
+        if (count_sites) sites[site()].and_gates++;
+        c0.lo = _mm_and_si128(a0.lo, b0.lo);
+        c0.hi = _mm_and_si128(a0.hi, b0.hi);
+    }
+
+    __attribute__((noinline))
+    void xor_gate(Label& c0, Label& c1, const Label& a0, const Label& a1,
+            const Label& b0, const Label& b1) override {
+        count.xor_gates++;
+        if (count_sites) sites[site()].xor_gates++;
+        c0.lo = _mm_xor_si128(a0.lo, b0.lo);
+        c0.hi = _mm_xor_si128(a0.hi, b0.hi);
+    }
+
+    __attribute__((noinline))
+    void not_gate(Label& b0, Label& b1, const Label& a0, const Label& a1) override {
+        count.not_gates++;
+        if (count_sites) sites[site()].not_gates++;
+        Label one = one_label();
+        b0.lo = _mm_xor_si128(a0.lo, one.lo);
+        b0.hi = _mm_xor_si128(a0.hi, one.hi);
+    }
+
+    __attribute__((noinline))
+    void* site() {
+        void* frames[CLEAR_SITE_DEPTH];
+        int n = backtrace(frames, CLEAR_SITE_DEPTH);
+        for (int i = 2; i < n; i++) {
+            if (!in_bit(frames[i])) return frames[i];
+        }
+        return (n > 2) ? frames[2] : nullptr;
+    }
+
+    // Whether address lies in a member function of Bit, cached per address
+    bool in_bit(void* address) {
+        auto it = bit_frames.find(address);
+        if (it != bit_frames.end()) return it->second;
+        Dl_info info;
+        bool found = dladdr(address, &info) != 0 && info.dli_sname != nullptr
+            && (strncmp(info.dli_sname, "_ZN3emp3Bit", 11) == 0
+                || strncmp(info.dli_sname, "_ZNK3emp3Bit", 12) == 0);
+        bit_frames[address] = found;
+        return found;
+    }
+
+    void reset() {
+        count = GateCount();
+        sites.clear();
+    }
+
+    // Prints the top call sites with the most gates. A site is shown as its
+    // function if the binary exports it (-rdynamic), and as an offset in its
+    // binary for addr2line -f -C -e <binary> <offset> otherwise.
+    void print_sites(FILE* out = stdout, int top = 20) const {
+        std::vector<std::pair<void*, GateCount>> sorted(sites.begin(), sites.end());
+        std::sort(sorted.begin(), sorted.end(), [](const std::pair<void*, GateCount>& a,
+                    const std::pair<void*, GateCount>& b) {
+            return a.second.total() > b.second.total();
+        });
+        fprintf(out, "%12s %12s %12s  %s\n", "AND", "XOR", "NOT", "call site");
+        for (int i = 0; i < (int) sorted.size() && i < top; i++) {
+            const GateCount& c = sorted[i].second;
+            fprintf(out, "%12lu %12lu %12lu  %s\n", c.and_gates, c.xor_gates, c.not_gates,
+                    site_name(sorted[i].first).c_str());
+        }
+        fprintf(out, "%12lu %12lu %12lu  total\n", count.and_gates, count.xor_gates,
+                count.not_gates);
+    }
+
+    static std::string site_name(void* address) {
+        char buffer[64];
+        Dl_info info;
+        if (dladdr(address, &info) == 0) {
+            snprintf(buffer, sizeof(buffer), "%p", address);
+            return buffer;
+        }
+        std::string name;
+        if (info.dli_sname != nullptr) {
+            int status;
+            char* demangled = abi::__cxa_demangle(info.dli_sname, nullptr, nullptr, &status);
+            name = (status == 0) ? demangled : info.dli_sname;
+            free(demangled);
+            snprintf(buffer, sizeof(buffer), "+0x%lx",
+                    (unsigned long) ((char*) address - (char*) info.dli_saddr));
+        } else {
+            name = (info.dli_fname != nullptr) ? info.dli_fname : "?";
+            snprintf(buffer, sizeof(buffer), "+0x%lx",
+                    (unsigned long) ((char*) address - (char*) info.dli_fbase));
+        }
+        return name + buffer;
+    }
+};
+
+// Inputs of both parties are known in the clear. An input bit goes to all 64
+// instances; feed_words gives each instance its own value.
+class ClearProtocolExecution: public ProtocolExecution {
+public:
+    ClearProtocolExecution(): ProtocolExecution(PUBLIC) {}
+
+    void feed(Label* label0, Label* label1, int party, const bool* b, int length) override {
+        for (int i = 0; i < length; i++) {
+            label0[i] = ClearCircuitExecution::label(b[i] ? ~0ULL : 0);
+        }
+    }
+
+    // Reveals instance 0
+    void reveal(bool* out, int party, const Label* label, int length) override {
+        for (int i = 0; i < length; i++) {
+            out[i] = ClearCircuitExecution::word(label[i]) & 1;
+        }
+    }
+};
+
+// Runs the circuits of the calling thread in the clear, like
+// setup_semi_honest does for the protocol
+inline ClearCircuitExecution* setup_clear() {
+    ClearCircuitExecution* t = new ClearCircuitExecution();
+    CircuitExecution::circ_exec = t;
+    ProtocolExecution::prot_exec = new ClearProtocolExecution();
+    return t;
+}
+
+// words[i] holds bit i of the 64 instances, bit k of it for instance k
+inline void slice_values(uint64_t* words, const uint64_t* values, int length) {
+    for (int i = 0; i < length; i++) {
+        uint64_t w = 0;
+        for (int k = 0; k < 64; k++) {
+            w |= ((values[k] >> i) & 1) << k;
+        }
+        words[i] = w;
+    }
+}
+
+inline void unslice_values(uint64_t* values, const uint64_t* words, int length) {
+    for (int k = 0; k < 64; k++) {
+        uint64_t v = 0;
+        for (int i = 0; i < length; i++) {
+            v |= ((words[i] >> k) & 1) << i;
+        }
+        values[k] = v;
+    }
+}
+
+// Gives the bits, such as those of an Integer, their sliced words
+template<typename B>
+void feed_words(B* bits, const uint64_t* words, int length) {
+    for (int i = 0; i < length; i++) {
+        bits[i].bit0 = ClearCircuitExecution::label(words[i]);
+    }
+}
+
+template<typename B>
+void reveal_words(uint64_t* words, const B* bits, int length) {
+    for (int i = 0; i < length; i++) {
+        words[i] = ClearCircuitExecution::word(bits[i].bit0);
+    }
+}
+}
+#endif// CLEAR_EXECUTION_H__
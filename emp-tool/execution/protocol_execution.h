@@ -8,7 +8,11 @@ namespace emp {
 class ProtocolExecution { 
 public:
 	int cur_party;
+#ifndef THREADING
 	static ProtocolExecution * prot_exec;
+#else
+	static __thread ProtocolExecution * prot_exec;
+#endif
 
 	ProtocolExecution(int party = PUBLIC) : cur_party (party) {}
 	virtual ~ProtocolExecution() {}
@@ -16,6 +20,12 @@ public:
 	virtual void feed(Label * lbls0, Label * lbls1, int party, const bool* b, int nel) {}
 	virtual void reveal(bool*out, int party, const Label *lbls, int nel) {}
     virtual void do_batched_ot() {}
+    // Start the batched OTs without waiting for them, so that the circuit can
+    // be garbled in the meantime
+    virtual void start_batched_ot() { do_batched_ot(); }
+    // Block until the OTs started by start_batched_ot are done
+    virtual void wait_batched_ot() {}
+    virtual void precompute_ot(int num_ot) {}
 	virtual void finalize() {}
 };
 }
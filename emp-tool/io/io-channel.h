@@ -0,0 +1,61 @@
+#ifndef IO_CHANNEL_H__
+#define IO_CHANNEL_H__
+#include <stdint.h>
+#include <stddef.h>
+#include <functional>
+
+namespace emp {
+// Interface of a bidirectional byte stream between the two parties. Buffered
+// data may stay with the sender until flush, or until the sender calls
+// recv_data, while unbuffered data is passed on right away. One thread may
+// send while another one receives on the same channel.
+class IOChannel {
+public:
+    bool is_server = false;
+    uint64_t send_counter = 0;
+    uint64_t recv_counter = 0;
+
+    virtual ~IOChannel() {}
+
+    virtual void send_data(const void* data, size_t len, bool buffered = true) = 0;
+    // Returns the number of bytes received, which is less than len only if
+    // the connection failed
+    virtual size_t recv_data(void* data, size_t len, bool buffered = true) = 0;
+    virtual void flush() = 0;
+
+    // Sends a message header and its payload right away, together with any
+    // buffered data. Neither part is buffered, so that a thread receiving on
+    // the channel meanwhile has nothing of this thread's to flush.
+    virtual void send_frame(const void* header, size_t header_len,
+            const void* payload, size_t payload_len) {
+        send_data(header, header_len, false);
+        send_data(payload, payload_len, false);
+    }
+
+    // Like send_frame, but the channel may keep reading payload after the
+    // call returns, and calls release once it no longer needs it
+    virtual void send_frame_async(const void* header, size_t header_len,
+            const void* payload, size_t payload_len, std::function<void()> release) {
+        send_frame(header, header_len, payload, payload_len);
+        release();
+    }
+
+    // Round trip, which returns once the other party has called sync as well
+    void sync() {
+        int tmp = 0;
+        if(is_server) {
+            send_data(&tmp, 1, true);
+            recv_data(&tmp, 1, true);
+        } else {
+            recv_data(&tmp, 1, true);
+            send_data(&tmp, 1, true);
+            flush();
+        }
+    }
+
+    uint64_t get_total_comm() {
+        return send_counter + recv_counter;
+    }
+};
+}
+#endif // IO_CHANNEL_H__
@@ -12,24 +12,47 @@
 #include <netinet/tcp.h>
 #include <netinet/in.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
+#include <poll.h>
+#include <linux/errqueue.h>
+#include <errno.h>
+#include <atomic>
+#include <algorithm>
+#include <deque>
+#include <vector>
+#include <functional>
+#include "emp-tool/io/io-channel.h"
 
-#define NETWORK_BUFFER_SIZE 1024*16
+#define NETWORK_BUFFER_SIZE (1 << 21)
+// Kernel buffer requested for each direction of the socket
+#define NETWORK_SOCKET_BUFFER_SIZE (1 << 22)
+// Smallest send that goes out with MSG_ZEROCOPY once set_zerocopy is on;
+// below it, pinning the pages costs more than the copy
+#define NETWORK_ZEROCOPY_SIZE (1 << 18)
+// Zero-copy sends the kernel may hold before the sender waits for one
+#define NETWORK_ZEROCOPY_MAX_PENDING 16
 
 namespace emp {
-class NetIO{
+// TCP connection to the other party. Sent data is collected in a user-space
+// buffer of buffer_size bytes, and goes out with the pending bytes in a
+// single writev when the buffer fills up, on flush, or with the next
+// unbuffered send or frame. Received data is read in chunks of up to
+// buffer_size bytes, while larger transfers are read straight into the
+// destination. Reads always go through the buffer, so the buffered flag
+// only matters for sends.
+// With set_zerocopy, a full send buffer and the payloads of send_frame_async
+// are passed to the kernel without a copy. The kernel reads their pages
+// until it reports the send complete on the socket's error queue, so a sent
+// buffer is swapped for a spare one, and goes back to the spares once its
+// completion arrives.
+class NetIO: public IOChannel {
 public:
-    bool is_server;
     int mysocket = -1;
     int consocket = -1;
-    FILE * stream = nullptr;
-    char * buffer = nullptr;
-    bool has_sent = false;
     std::string addr;
     int port;
-    uint64_t send_counter = 0;
-    uint64_t recv_counter = 0;
 
-    NetIO(const char* address, int port) {
+    NetIO(const char* address, int port, size_t buffer_size = NETWORK_BUFFER_SIZE) {
         this->port = port;
         is_server = (address == nullptr);
         if (address == nullptr) {
@@ -73,30 +96,29 @@ public:
                 usleep(1000);
             }
         }
-        set_nodelay();
-        stream = fdopen(consocket, "wb+");
-        buffer = new char[NETWORK_BUFFER_SIZE];
-        memset(buffer, 0, NETWORK_BUFFER_SIZE);
-        setvbuf(stream, buffer, _IOFBF, NETWORK_BUFFER_SIZE);
-        // setvbuf(stream, buffer, _IONBF, NETWORK_BUFFER_SIZE);
-        std::cout << "connected" << std::endl;
+        init(buffer_size);
     }
 
-    ~NetIO(){
-        fflush(stream);
-        close(consocket);
-        delete[] buffer;
+    // Takes over a connected socket, such as one accepted by a server that
+    // listens for several clients
+    NetIO(int socket, bool is_server, size_t buffer_size = NETWORK_BUFFER_SIZE) {
+        this->port = -1;
+        this->is_server = is_server;
+        consocket = socket;
+        init(buffer_size);
     }
 
-    void sync() {
-        int tmp = 0;
-        if(is_server) {
-            send_data(&tmp, 1, true);
-            recv_data(&tmp, 1, true);
-        } else {
-            recv_data(&tmp, 1, true);
-            send_data(&tmp, 1, true);
-            flush();
+    ~NetIO() override {
+        flush();
+        while (!zerocopy_pending.empty()) {
+            reap_completions(true);
+        }
+        close(consocket);
+        if (mysocket >= 0) close(mysocket);
+        delete[] send_buffer;
+        delete[] recv_buffer;
+        for(char* buffer : spare_buffers) {
+            delete[] buffer;
         }
     }
 
@@ -110,53 +132,276 @@ public:
         setsockopt(consocket,IPPROTO_TCP,TCP_NODELAY,&zero,sizeof(zero));
     }
 
-    void flush() {
-        fflush(stream);
+    // The kernel may cap the sizes at net.core.wmem_max and rmem_max
+    void set_socket_buffers(int size) {
+        setsockopt(consocket, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+        setsockopt(consocket, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size));
     }
 
-    uint64_t get_total_comm() {
-        return send_counter + recv_counter;
+    // Sends of NETWORK_ZEROCOPY_SIZE bytes and more go out with
+    // MSG_ZEROCOPY. Returns false, and keeps copying, if the kernel does not
+    // support it.
+    virtual bool set_zerocopy(bool enable) {
+        int value = enable ? 1 : 0;
+        if (setsockopt(consocket, SOL_SOCKET, SO_ZEROCOPY, &value, sizeof(value)) < 0) {
+            zerocopy = false;
+            return !enable;
+        }
+        zerocopy = enable;
+        return true;
     }
 
-    void send_data(const void* data, int len, bool buffered = true) {
-        // If using non-buffered IO, make sure the bufferd IO stream is flushed
-        if (!buffered) flush();
+    void flush() override {
+        if (send_len > 0) {
+            struct iovec iov = {send_buffer, send_len};
+            write_pending(&iov, 1);
+        }
+        has_sent = false;
+    }
+
+    void send_data(const void* data, size_t len, bool buffered = true) override {
         send_counter += len;
-        int sent = 0;
-        int res;
-        while(sent < len) {
-            if (buffered) {
-                res = fwrite(sent + (char*)data, 1, len - sent, stream);
+        if (buffered && send_len + len <= buffer_size) {
+            memcpy(send_buffer + send_len, data, len);
+            send_len += len;
+            has_sent = true;
+            return;
+        }
+        // The pending bytes and data leave together, without copying data
+        struct iovec iov[2] = {{send_buffer, send_len}, {(void*) data, len}};
+        write_pending(iov, 2);
+    }
+
+    void send_frame(const void* header, size_t header_len,
+            const void* payload, size_t payload_len) override {
+        send_counter += header_len + payload_len;
+        struct iovec iov[3] = {{send_buffer, send_len},
+            {(void*) header, header_len}, {(void*) payload, payload_len}};
+        write_pending(iov, 3);
+    }
+
+    void send_frame_async(const void* header, size_t header_len,
+            const void* payload, size_t payload_len, std::function<void()> release) override {
+        if (!zerocopy || payload_len < NETWORK_ZEROCOPY_SIZE) {
+            send_frame(header, header_len, payload, payload_len);
+            release();
+            return;
+        }
+        send_counter += header_len + payload_len;
+        struct iovec iov[2] = {{send_buffer, send_len}, {(void*) header, header_len}};
+        write_pending(iov, 2);
+        send_zerocopy((const char*) payload, payload_len, std::move(release));
+    }
+
+    size_t recv_data(void* data, size_t len, bool buffered = true) override {
+        if (has_sent) flush();
+        recv_counter += len;
+        char* dst = (char*) data;
+        size_t received = std::min(len, recv_end - recv_pos);
+        memcpy(dst, recv_buffer + recv_pos, received);
+        recv_pos += received;
+        while (received < len) {
+            size_t left = len - received;
+            ssize_t res;
+            if (left >= buffer_size) {
+                res = recv(consocket, dst + received, left, 0);
+                if (res > 0) received += res;
             } else {
-                res = send(consocket, sent + (char*)data, len - sent, 0);
+                res = recv(consocket, recv_buffer, buffer_size, 0);
+                if (res > 0) {
+                    recv_end = res;
+                    recv_pos = std::min(left, (size_t) res);
+                    memcpy(dst + received, recv_buffer, recv_pos);
+                    received += recv_pos;
+                }
+            }
+            if (res == 0 || (res < 0 && errno != EINTR)) {
+                fprintf(stderr,"error: net_recv_data %zd\n", res);
+                break;
             }
-            if (res >= 0)
-                sent+=res;
-            else
-                fprintf(stderr,"error: net_send_data %d\n", res);
         }
-        has_sent = true;
+        return received;
     }
 
-    int recv_data(void* data, int len, bool buffered = true) {
-        if(has_sent) fflush(stream);
-        has_sent = false;
-        recv_counter += len;
-        int sent = 0;
-        int res;
-        while(sent < len) {
-            if (buffered) {
-                res = fread(sent + (char*)data, 1, len - sent, stream);
+    // Sends that went out with MSG_ZEROCOPY, and those the kernel completed
+    // by copying after all, as it does over loopback
+    uint64_t zerocopy_sends = 0;
+    uint64_t zerocopy_copied = 0;
+
+private:
+    void init(size_t buffer_size) {
+        set_nodelay();
+        set_socket_buffers(NETWORK_SOCKET_BUFFER_SIZE);
+        this->buffer_size = buffer_size;
+        // Subclasses with buffers of their own pass 0
+        if (buffer_size > 0) {
+            send_buffer = new char[buffer_size];
+            recv_buffer = new char[buffer_size];
+        }
+        std::cout << "connected" << std::endl;
+    }
+
+    struct ZeroCopySend {
+        // Completion id following the last sendmsg of the send
+        uint32_t end_id;
+        std::function<void()> release;
+    };
+
+    // Writes out iov, whose first entry is the pending part of send_buffer,
+    // and empties the buffer. A large enough buffer goes out without a copy,
+    // and a spare one takes its place.
+    void write_pending(struct iovec* iov, int count) {
+        if (zerocopy && iov[0].iov_len >= NETWORK_ZEROCOPY_SIZE) {
+            char* buffer = send_buffer;
+            if (spare_buffers.empty()) {
+                send_buffer = new char[buffer_size];
             } else {
-                res = recv(consocket, sent + (char*)data, len - sent, 0);
+                send_buffer = spare_buffers.back();
+                spare_buffers.pop_back();
+            }
+            send_zerocopy(buffer, iov[0].iov_len, [this, buffer]() {
+                spare_buffers.push_back(buffer);
+            });
+            iov++;
+            count--;
+        }
+        write_all(iov, count);
+        send_len = 0;
+        has_sent = false;
+    }
+
+    // Sends data with MSG_ZEROCOPY, and calls release once the kernel
+    // reports every part of it complete. Falls back to copying the rest if
+    // the kernel refuses to pin more pages.
+    void send_zerocopy(const char* data, size_t len, std::function<void()> release) {
+        uint32_t start_id = zerocopy_next_id;
+        while (len > 0) {
+            struct iovec iov = {(void*) data, len};
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_iov = &iov;
+            msg.msg_iovlen = 1;
+            ssize_t res = sendmsg(consocket, &msg, MSG_ZEROCOPY);
+            if (res < 0) {
+                if (errno == EINTR) continue;
+                if (errno == ENOBUFS) {
+                    write_all(&iov, 1);
+                } else {
+                    fprintf(stderr,"error: net_send_data %zd\n", res);
+                }
+                break;
+            }
+            zerocopy_next_id++;
+            zerocopy_sends++;
+            data += res;
+            len -= res;
+        }
+        if (zerocopy_next_id == start_id) {
+            release();
+        } else {
+            zerocopy_pending.push_back({zerocopy_next_id, std::move(release)});
+        }
+        reap_completions(false);
+        while (zerocopy_pending.size() > NETWORK_ZEROCOPY_MAX_PENDING) {
+            reap_completions(true);
+        }
+    }
+
+    // Reads the completions off the error queue, and releases the sends they
+    // finish. TCP completes zero-copy sends in order. If block is set, waits
+    // for a completion first.
+    void reap_completions(bool block) {
+        if (block) {
+            struct pollfd pfd = {consocket, 0, 0};
+            if (poll(&pfd, 1, -1) < 0 && errno != EINTR) block = false;
+        }
+        bool reaped = false;
+        while (true) {
+            char control[128];
+            struct msghdr msg;
+            memset(&msg, 0, sizeof(msg));
+            msg.msg_control = control;
+            msg.msg_controllen = sizeof(control);
+            if (recvmsg(consocket, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) break;
+            for(struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg != nullptr;
+                    cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+                if (!(cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR)
+                        && !(cmsg->cmsg_level == SOL_IPV6 && cmsg->cmsg_type == IPV6_RECVERR)) {
+                    continue;
+                }
+                struct sock_extended_err* err = (struct sock_extended_err*) CMSG_DATA(cmsg);
+                if (err->ee_errno != 0 || err->ee_origin != SO_EE_ORIGIN_ZEROCOPY) continue;
+                // Sends ee_info to ee_data are complete
+                zerocopy_completed = err->ee_data + 1;
+                if (err->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) {
+                    zerocopy_copied += err->ee_data - err->ee_info + 1;
+                }
+                reaped = true;
+            }
+        }
+        while (!zerocopy_pending.empty()
+                && (int32_t) (zerocopy_completed - zerocopy_pending.front().end_id) >= 0) {
+            zerocopy_pending.front().release();
+            zerocopy_pending.pop_front();
+        }
+        if (block && !reaped) {
+            // The connection is gone and no completion will come
+            int error = 0;
+            socklen_t error_len = sizeof(error);
+            getsockopt(consocket, SOL_SOCKET, SO_ERROR, &error, &error_len);
+            if (error != 0) {
+                while (!zerocopy_pending.empty()) {
+                    zerocopy_pending.front().release();
+                    zerocopy_pending.pop_front();
+                }
             }
-            if (res >= 0)
-                sent += res;
-            else
-                fprintf(stderr,"error: net_send_data %d\n", res);
         }
-        return sent;
     }
+
+    // Writes out every iovec, resuming after partial writes
+    void write_all(struct iovec* iov, int count) {
+        while (count > 0) {
+            if (iov->iov_len == 0) {
+                iov++;
+                count--;
+                continue;
+            }
+            ssize_t res = writev(consocket, iov, count);
+            if (res < 0) {
+                if (errno == EINTR) continue;
+                fprintf(stderr,"error: net_send_data %zd\n", res);
+                return;
+            }
+            while (count > 0 && (size_t) res >= iov->iov_len) {
+                res -= iov->iov_len;
+                iov++;
+                count--;
+            }
+            if (count > 0) {
+                iov->iov_base = (char*) iov->iov_base + res;
+                iov->iov_len -= res;
+            }
+        }
+    }
+
+    size_t buffer_size;
+    char* send_buffer = nullptr;
+    size_t send_len = 0;
+    // Received bytes not read yet are recv_buffer[recv_pos, recv_end)
+    char* recv_buffer = nullptr;
+    size_t recv_pos = 0;
+    size_t recv_end = 0;
+    bool zerocopy = false;
+    std::deque<ZeroCopySend> zerocopy_pending;
+    uint32_t zerocopy_next_id = 0;
+    uint32_t zerocopy_completed = 0;
+    // Send buffers whose zero-copy sends are complete
+    std::vector<char*> spare_buffers;
+
+protected:
+    // Set while send_buffer holds data. May be read by a thread receiving
+    // while another one sends.
+    std::atomic<bool> has_sent{false};
 };
 }
 #endif // NET_IO_H__
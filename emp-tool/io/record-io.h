@@ -0,0 +1,154 @@
+#ifndef RECORD_IO_H__
+#define RECORD_IO_H__
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include "emp-tool/io/io-channel.h"
+
+// Start of a transcript file, followed by a byte telling if the recording
+// party was the server, and then by the records
+#define TRANSCRIPT_MAGIC "EMPTRSC1"
+#define TRANSCRIPT_MAGIC_SIZE 8
+
+namespace emp {
+// Wraps a channel, and writes everything sent and received through it to a
+// transcript file, so that ReplayIO can later run the same party without
+// its peer. Each send and each receive is one record: a byte that is 0 for
+// sent data and 1 for received data, the length as a uint64_t, and the
+// data. Takes ownership of the wrapped channel.
+class RecordIO: public IOChannel {
+public:
+    RecordIO(IOChannel* io, const char* path) {
+        this->io = io;
+        is_server = io->is_server;
+        file = fopen(path, "wb");
+        if (file == nullptr) {
+            perror("error: fopen");
+            exit(1);
+        }
+        uint8_t server = is_server;
+        fwrite(TRANSCRIPT_MAGIC, 1, TRANSCRIPT_MAGIC_SIZE, file);
+        fwrite(&server, 1, 1, file);
+    }
+
+    ~RecordIO() override {
+        io->flush();
+        fclose(file);
+        delete io;
+    }
+
+    void send_data(const void* data, size_t len, bool buffered = true) override {
+        send_counter += len;
+        record(0, data, len);
+        io->send_data(data, len, buffered);
+    }
+
+    size_t recv_data(void* data, size_t len, bool buffered = true) override {
+        size_t received = io->recv_data(data, len, buffered);
+        recv_counter += received;
+        record(1, data, received);
+        return received;
+    }
+
+    void flush() override {
+        io->flush();
+        std::lock_guard<std::mutex> lock(mutex);
+        fflush(file);
+    }
+
+private:
+    // One thread may send while another one receives
+    void record(uint8_t direction, const void* data, uint64_t len) {
+        std::lock_guard<std::mutex> lock(mutex);
+        fwrite(&direction, 1, 1, file);
+        fwrite(&len, sizeof(uint64_t), 1, file);
+        fwrite(data, 1, len, file);
+    }
+
+    IOChannel* io;
+    FILE* file;
+    std::mutex mutex;
+};
+
+// Plays back the party of a transcript written by RecordIO: received data
+// comes from the recording at memory speed, and sent data is dropped after
+// comparison with the recording, so that the party's computation can be
+// measured without the other party. The party must make the same choices
+// as when it was recorded, so runs to replay fix the seed of their PRGs,
+// see PRG::set_default_seed.
+class ReplayIO: public IOChannel {
+public:
+    // Offset of the first sent byte that differs from the recording, or
+    // UINT64_MAX while the party sends what it sent when recorded
+    uint64_t divergence = UINT64_MAX;
+
+    explicit ReplayIO(const char* path) {
+        FILE* file = fopen(path, "rb");
+        if (file == nullptr) {
+            perror("error: fopen");
+            exit(1);
+        }
+        char magic[TRANSCRIPT_MAGIC_SIZE];
+        uint8_t server;
+        if (fread(magic, 1, TRANSCRIPT_MAGIC_SIZE, file) != TRANSCRIPT_MAGIC_SIZE
+                || memcmp(magic, TRANSCRIPT_MAGIC, TRANSCRIPT_MAGIC_SIZE) != 0
+                || fread(&server, 1, 1, file) != 1) {
+            fprintf(stderr, "error: %s is not a transcript\n", path);
+            exit(1);
+        }
+        is_server = server;
+        // Both streams are loaded up front, so that replay does not read
+        // the file
+        uint8_t direction;
+        uint64_t len;
+        while (fread(&direction, 1, 1, file) == 1 && fread(&len, sizeof(uint64_t), 1, file) == 1) {
+            std::vector<char>& stream = (direction == 0) ? sent : received;
+            size_t offset = stream.size();
+            stream.resize(offset + len);
+            if (fread(stream.data() + offset, 1, len, file) != len) {
+                fprintf(stderr, "error: transcript %s is truncated\n", path);
+                stream.resize(offset);
+                break;
+            }
+        }
+        fclose(file);
+    }
+
+    void send_data(const void* data, size_t len, bool buffered = true) override {
+        if (divergence == UINT64_MAX) {
+            size_t n = std::min(len, sent.size() - std::min(sent.size(), (size_t) send_counter));
+            const char* recorded = sent.data() + send_counter;
+            if (n < len || memcmp(data, recorded, n) != 0) {
+                size_t i = 0;
+                while (i < n && ((const char*) data)[i] == recorded[i]) i++;
+                divergence = send_counter + i;
+            }
+        }
+        send_counter += len;
+    }
+
+    size_t recv_data(void* data, size_t len, bool buffered = true) override {
+        size_t n = std::min(len, received.size() - recv_pos);
+        memcpy(data, received.data() + recv_pos, n);
+        recv_pos += n;
+        recv_counter += n;
+        if (n < len) {
+            fprintf(stderr, "error: transcript ends after %zu bytes\n", received.size());
+        }
+        return n;
+    }
+
+    void flush() override {
+    }
+
+private:
+    std::vector<char> sent;
+    std::vector<char> received;
+    size_t recv_pos = 0;
+};
+}
+#endif // RECORD_IO_H__
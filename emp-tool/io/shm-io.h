@@ -0,0 +1,339 @@
+#ifndef SHM_IO_H__
+#define SHM_IO_H__
+#include <iostream>
+#include <atomic>
+#include <thread>
+#include <algorithm>
+#include <string>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <stddef.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <sys/un.h>
+#include <linux/futex.h>
+#include <emmintrin.h>
+#include "emp-tool/io/io-channel.h"
+
+// Bytes of the ring of each direction, a power of two
+#define SHM_RING_SIZE (1 << 22)
+// Buffered bytes handed to the other party without waiting for flush
+#define SHM_PUBLISH_SIZE (1 << 14)
+// Checks of the ring before a waiting party yields, and then sleeps
+#define SHM_SPIN_ITERATIONS 1024
+#define SHM_YIELD_ITERATIONS 64
+
+namespace emp {
+// One direction of a SharedMemIO: a single-producer single-consumer byte
+// ring. head and tail count the bytes written and read so far. The sequence
+// numbers move with them, and a party that runs out of bytes or of room
+// sleeps on the other side's sequence number with futex.
+struct ShmRing {
+    alignas(64) std::atomic<uint64_t> head;
+    std::atomic<uint32_t> head_seq;
+    std::atomic<uint32_t> reader_waiting;
+    alignas(64) std::atomic<uint64_t> tail;
+    std::atomic<uint32_t> tail_seq;
+    std::atomic<uint32_t> writer_waiting;
+};
+
+// Start of the shared memory, followed by the data of both rings. The server
+// sends on rings[0] and the client on rings[1].
+struct ShmRegion {
+    uint64_t ring_size;
+    ShmRing rings[2];
+};
+
+// IO channel between two parties on the same host, over a pair of lock-free
+// rings in shared memory instead of a socket. The parties may be threads of
+// one process, or processes that pass the memfd of the memory over a Unix
+// socket. Waiting parties spin, yield, and then sleep with futex, which works
+// across processes.
+class SharedMemIO: public IOChannel {
+public:
+    // Connects to the party with the same port on this host, like NetIO: the
+    // server (address == nullptr) creates the memory and sends it to the
+    // client over the abstract Unix socket named after port
+    SharedMemIO(const char* address, int port, uint64_t ring_size = SHM_RING_SIZE) {
+        is_server = (address == nullptr);
+        struct sockaddr_un name;
+        memset(&name, 0, sizeof(name));
+        name.sun_family = AF_UNIX;
+        std::string path = "emp-shm-io-" + std::to_string(port);
+        // Leading zero byte: abstract name, removed with the socket
+        memcpy(name.sun_path + 1, path.c_str(), path.size());
+        socklen_t name_len = offsetof(struct sockaddr_un, sun_path) + 1 + path.size();
+
+        int fd;
+        if (is_server) {
+            fd = create_memory(ring_size);
+            int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+            if (::bind(listener, (struct sockaddr*) &name, name_len) < 0) {
+                perror("error: bind");
+                exit(1);
+            }
+            if (listen(listener, 1) < 0) {
+                perror("error: listen");
+                exit(1);
+            }
+            int sock = accept(listener, nullptr, nullptr);
+            send_fd(sock, fd);
+            close(sock);
+            close(listener);
+        } else {
+            int sock;
+            while (true) {
+                sock = socket(AF_UNIX, SOCK_STREAM, 0);
+                if (connect(sock, (struct sockaddr*) &name, name_len) == 0) {
+                    break;
+                }
+                close(sock);
+                usleep(1000);
+            }
+            fd = recv_fd(sock);
+            close(sock);
+        }
+        map(fd);
+        close(fd);
+        std::cout << "connected" << std::endl;
+    }
+
+    // Maps the memory of fd, made by create_memory. Both parties may run in
+    // the same process, and fd may be closed once both are constructed.
+    SharedMemIO(int fd, bool is_server) {
+        this->is_server = is_server;
+        map(fd);
+    }
+
+    ~SharedMemIO() override {
+        flush();
+        munmap(region, region_size);
+    }
+
+    // Shared memory for a pair of SharedMemIO objects. The rings are indexed
+    // with a mask, so ring_size is rounded up to a power of two.
+    static int create_memory(uint64_t ring_size = SHM_RING_SIZE) {
+        uint64_t size_pow2 = 1;
+        while (size_pow2 < ring_size) size_pow2 <<= 1;
+        ring_size = size_pow2;
+        int fd = memfd_create("emp-shm-io", MFD_CLOEXEC);
+        if (fd < 0) {
+            perror("error: memfd_create");
+            exit(1);
+        }
+        uint64_t size = sizeof(ShmRegion) + 2 * ring_size;
+        if (ftruncate(fd, size) < 0) {
+            perror("error: ftruncate");
+            exit(1);
+        }
+        // ftruncate fills the memory with zeros, which leaves the rings empty
+        ShmRegion* region = (ShmRegion*) mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+        if (region == MAP_FAILED) {
+            perror("error: mmap");
+            exit(1);
+        }
+        region->ring_size = ring_size;
+        munmap(region, size);
+        return fd;
+    }
+
+    void send_data(const void* data, size_t len, bool buffered = true) override {
+        send_counter += len;
+        const char* src = (const char*) data;
+        uint64_t left = len;
+        while (left > 0) {
+            uint64_t room = ring_size - (head - out->tail.load(std::memory_order_acquire));
+            if (room == 0) {
+                // Hand over what is written so far, and wait for the reader
+                publish();
+                wait_for([&]() {
+                    return out->tail.load(std::memory_order_acquire) + ring_size != head;
+                }, out->tail_seq, out->writer_waiting);
+                continue;
+            }
+            uint64_t n = std::min(room, left);
+            copy_in(out_data, head, src, n);
+            head += n;
+            src += n;
+            left -= n;
+        }
+        if (!buffered || head - published >= SHM_PUBLISH_SIZE) {
+            publish();
+        } else {
+            has_sent = true;
+        }
+    }
+
+    size_t recv_data(void* data, size_t len, bool buffered = true) override {
+        if (has_sent) flush();
+        recv_counter += len;
+        char* dst = (char*) data;
+        uint64_t left = len;
+        while (left > 0) {
+            uint64_t available = in->head.load(std::memory_order_acquire) - tail;
+            if (available == 0) {
+                wait_for([&]() {
+                    return in->head.load(std::memory_order_acquire) != tail;
+                }, in->head_seq, in->reader_waiting);
+                continue;
+            }
+            uint64_t n = std::min(available, left);
+            copy_out(dst, in_data, tail, n);
+            tail += n;
+            dst += n;
+            left -= n;
+            in->tail.store(tail, std::memory_order_release);
+            notify(in->tail_seq, in->writer_waiting);
+        }
+        return len;
+    }
+
+    void flush() override {
+        publish();
+    }
+
+private:
+    void map(int fd) {
+        struct stat st;
+        fstat(fd, &st);
+        region_size = st.st_size;
+        region = (ShmRegion*) mmap(nullptr, region_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED, fd, 0);
+        if (region == MAP_FAILED) {
+            perror("error: mmap");
+            exit(1);
+        }
+        ring_size = region->ring_size;
+        if (ring_size == 0 || (ring_size & (ring_size - 1)) != 0
+                || region_size < sizeof(ShmRegion) + 2 * ring_size) {
+            fprintf(stderr, "error: shared memory has a bad ring size %lu\n", ring_size);
+            exit(1);
+        }
+        char* data = (char*) region + sizeof(ShmRegion);
+        int out_ring = is_server ? 0 : 1;
+        out = &region->rings[out_ring];
+        in = &region->rings[1 - out_ring];
+        out_data = data + out_ring * ring_size;
+        in_data = data + (1 - out_ring) * ring_size;
+    }
+
+    void publish() {
+        has_sent = false;
+        if (head == published) return;
+        published = head;
+        out->head.store(head, std::memory_order_release);
+        notify(out->head_seq, out->reader_waiting);
+    }
+
+    void copy_in(char* ring, uint64_t pos, const char* src, uint64_t n) {
+        uint64_t offset = pos & (ring_size - 1);
+        uint64_t first = std::min(n, ring_size - offset);
+        memcpy(ring + offset, src, first);
+        memcpy(ring, src + first, n - first);
+    }
+
+    void copy_out(char* dst, const char* ring, uint64_t pos, uint64_t n) {
+        uint64_t offset = pos & (ring_size - 1);
+        uint64_t first = std::min(n, ring_size - offset);
+        memcpy(dst, ring + offset, first);
+        memcpy(dst + first, ring, n - first);
+    }
+
+    // The other party bumps seq after every change it makes to the ring,
+    // and wakes this party if waiting is set. futex only sleeps while seq
+    // still holds the value read before the last check, so no wake-up is lost.
+    template <typename Ready>
+    static void wait_for(Ready ready, std::atomic<uint32_t>& seq,
+            std::atomic<uint32_t>& waiting) {
+        // Spinning only helps if the other party runs on another core
+        static const int spin_iterations =
+            (std::thread::hardware_concurrency() > 1) ? SHM_SPIN_ITERATIONS : 0;
+        for(int i = 0; i < spin_iterations; i++) {
+            if (ready()) return;
+            _mm_pause();
+        }
+        for(int i = 0; i < SHM_YIELD_ITERATIONS; i++) {
+            if (ready()) return;
+            std::this_thread::yield();
+        }
+        while (true) {
+            waiting.store(1);
+            uint32_t value = seq.load();
+            if (ready()) break;
+            syscall(SYS_futex, (uint32_t*) &seq, FUTEX_WAIT, value, nullptr, nullptr, 0);
+        }
+        waiting.store(0);
+    }
+
+    static void notify(std::atomic<uint32_t>& seq, std::atomic<uint32_t>& waiting) {
+        seq.fetch_add(1);
+        if (waiting.load()) {
+            syscall(SYS_futex, (uint32_t*) &seq, FUTEX_WAKE, INT_MAX, nullptr, nullptr, 0);
+        }
+    }
+
+    static void send_fd(int sock, int fd) {
+        char dummy = 0;
+        struct iovec iov = {&dummy, 1};
+        char control[CMSG_SPACE(sizeof(int))];
+        memset(control, 0, sizeof(control));
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+        memcpy(CMSG_DATA(cmsg), &fd, sizeof(int));
+        if (sendmsg(sock, &msg, 0) < 0) {
+            perror("error: sendmsg");
+            exit(1);
+        }
+    }
+
+    static int recv_fd(int sock) {
+        char dummy;
+        struct iovec iov = {&dummy, 1};
+        char control[CMSG_SPACE(sizeof(int))];
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        struct cmsghdr* cmsg;
+        if (recvmsg(sock, &msg, 0) <= 0 || (cmsg = CMSG_FIRSTHDR(&msg)) == nullptr
+                || cmsg->cmsg_type != SCM_RIGHTS) {
+            fprintf(stderr, "error: no shared memory received\n");
+            exit(1);
+        }
+        int fd;
+        memcpy(&fd, CMSG_DATA(cmsg), sizeof(int));
+        return fd;
+    }
+
+    ShmRegion* region = nullptr;
+    uint64_t region_size = 0;
+    uint64_t ring_size = 0;
+    ShmRing* out = nullptr;
+    ShmRing* in = nullptr;
+    char* out_data = nullptr;
+    char* in_data = nullptr;
+    // Bytes written to the out ring, and handed over to the other party
+    uint64_t head = 0;
+    uint64_t published = 0;
+    // Bytes read from the in ring
+    uint64_t tail = 0;
+    std::atomic<bool> has_sent{false};
+};
+}
+#endif // SHM_IO_H__
@@ -0,0 +1,467 @@
+#ifndef URING_IO_H__
+#define URING_IO_H__
+// linux/fs.h, included by linux/io_uring.h, has its own BLOCK_SIZE
+#pragma push_macro("BLOCK_SIZE")
+#include <linux/io_uring.h>
+#pragma pop_macro("BLOCK_SIZE")
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <atomic>
+#include "emp-tool/io/net-io.h"
+
+// Bytes of each registered buffer. Every direction has two of them, so that
+// one can be filled or drained while the kernel works on the other.
+#define URING_SLOT_SIZE (1 << 20)
+#define URING_QUEUE_DEPTH 8
+
+namespace emp {
+// Minimal io_uring instance driven through the raw system calls: a
+// submission queue filled by one thread at a time, and a completion queue
+// reaped by the same thread. Counts the io_uring_enter calls it makes.
+class Uring {
+public:
+    uint64_t enter_calls = 0;
+
+    explicit Uring(unsigned entries) {
+        struct io_uring_params params;
+        memset(&params, 0, sizeof(params));
+        fd = syscall(__NR_io_uring_setup, entries, &params);
+        if (fd < 0) {
+            perror("error: io_uring_setup");
+            exit(1);
+        }
+        sq_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+        cq_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+        bool single_mmap = params.features & IORING_FEAT_SINGLE_MMAP;
+        if (single_mmap) sq_size = cq_size = std::max(sq_size, cq_size);
+        sq_ptr = (char*) map(sq_size, IORING_OFF_SQ_RING);
+        cq_ptr = single_mmap ? sq_ptr : (char*) map(cq_size, IORING_OFF_CQ_RING);
+        sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+        sqes = (struct io_uring_sqe*) map(sqes_size, IORING_OFF_SQES);
+
+        sq_head = (std::atomic<unsigned>*) (sq_ptr + params.sq_off.head);
+        sq_tail = (std::atomic<unsigned>*) (sq_ptr + params.sq_off.tail);
+        sq_mask = *(unsigned*) (sq_ptr + params.sq_off.ring_mask);
+        sq_entries = params.sq_entries;
+        // Submission queue entry i always sits in slot i of the ring
+        unsigned* sq_array = (unsigned*) (sq_ptr + params.sq_off.array);
+        for(unsigned i = 0; i < sq_entries; i++) {
+            sq_array[i] = i;
+        }
+        cq_head = (std::atomic<unsigned>*) (cq_ptr + params.cq_off.head);
+        cq_tail = (std::atomic<unsigned>*) (cq_ptr + params.cq_off.tail);
+        cq_mask = *(unsigned*) (cq_ptr + params.cq_off.ring_mask);
+        cqes = (struct io_uring_cqe*) (cq_ptr + params.cq_off.cqes);
+        sq_local_tail = sq_tail->load(std::memory_order_relaxed);
+    }
+
+    ~Uring() {
+        munmap(sqes, sqes_size);
+        if (cq_ptr != sq_ptr) munmap(cq_ptr, cq_size);
+        munmap(sq_ptr, sq_size);
+        close(fd);
+    }
+
+    void register_buffers(const struct iovec* iov, unsigned count) {
+        if (syscall(__NR_io_uring_register, fd, IORING_REGISTER_BUFFERS, iov, count) < 0) {
+            perror("error: io_uring_register");
+            exit(1);
+        }
+    }
+
+    // Zeroed entry, queued with the next submit. The queue is deep enough
+    // for every operation UringIO keeps in flight.
+    struct io_uring_sqe* get_sqe() {
+        unsigned head = sq_head->load(std::memory_order_acquire);
+        if (sq_local_tail - head >= sq_entries) submit(0);
+        struct io_uring_sqe* sqe = &sqes[sq_local_tail & sq_mask];
+        memset(sqe, 0, sizeof(*sqe));
+        sq_local_tail++;
+        return sqe;
+    }
+
+    // Submits the queued entries and waits for wait_nr completions, in a
+    // single system call
+    void submit(unsigned wait_nr) {
+        unsigned to_submit = sq_local_tail - sq_tail->load(std::memory_order_relaxed);
+        sq_tail->store(sq_local_tail, std::memory_order_release);
+        if (to_submit == 0 && wait_nr == 0) return;
+        enter(to_submit, wait_nr);
+    }
+
+    bool peek(struct io_uring_cqe& cqe) {
+        unsigned head = cq_head->load(std::memory_order_relaxed);
+        if (head == cq_tail->load(std::memory_order_acquire)) return false;
+        cqe = cqes[head & cq_mask];
+        cq_head->store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    void wait(struct io_uring_cqe& cqe) {
+        while (!peek(cqe)) {
+            enter(0, 1);
+        }
+    }
+
+private:
+    void* map(size_t size, off_t offset) {
+        void* ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+                fd, offset);
+        if (ptr == MAP_FAILED) {
+            perror("error: io_uring mmap");
+            exit(1);
+        }
+        return ptr;
+    }
+
+    void enter(unsigned to_submit, unsigned wait_nr) {
+        unsigned flags = (wait_nr > 0) ? IORING_ENTER_GETEVENTS : 0;
+        enter_calls++;
+        while (syscall(__NR_io_uring_enter, fd, to_submit, wait_nr, flags, nullptr, 0) < 0) {
+            if (errno != EINTR) {
+                perror("error: io_uring_enter");
+                exit(1);
+            }
+            // Entries were not consumed, retry the submission
+        }
+    }
+
+    int fd;
+    char* sq_ptr;
+    char* cq_ptr;
+    size_t sq_size, cq_size, sqes_size;
+    struct io_uring_sqe* sqes;
+    std::atomic<unsigned>* sq_head;
+    std::atomic<unsigned>* sq_tail;
+    unsigned sq_mask, sq_entries;
+    unsigned sq_local_tail;
+    std::atomic<unsigned>* cq_head;
+    std::atomic<unsigned>* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+};
+
+// NetIO connection whose transfers go through io_uring, so that the thread
+// producing or consuming data does not wait for the socket:
+// - Sent data is collected in one of two registered buffers, and a full
+//   buffer is written with WRITE_FIXED while the sender fills the other one.
+// - A READ_FIXED into the idle registered buffer is always in flight, so the
+//   next bytes arrive while the receiver drains the current buffer.
+// - send_frame links the write of the pending bytes and the header to a send
+//   of the payload, and submits and waits for both in one system call.
+//   send_frame_async returns once they are submitted, and releases the
+//   payload when their completions are reaped, before the next operation
+//   is submitted or when the connection is closed.
+// - Receives of at least URING_COPY_SIZE bytes beyond the buffered ones go
+//   straight into the caller's memory.
+// - set_zerocopy is refused, so NetIO's own buffers and MSG_ZEROCOPY sends
+//   are never used.
+// Each direction has its own ring, so one thread may send while another one
+// receives, and at most one operation per direction is in flight, which
+// keeps the bytes in order. Transfers take about two io_uring_enter calls
+// per URING_SLOT_SIZE bytes.
+class UringIO: public NetIO {
+public:
+    UringIO(const char* address, int port, size_t slot_size = URING_SLOT_SIZE)
+        : NetIO(address, port, 0), send_ring(URING_QUEUE_DEPTH), recv_ring(URING_QUEUE_DEPTH) {
+        this->slot_size = slot_size;
+        struct iovec send_iov[2], recv_iov[2];
+        for(int i = 0; i < 2; i++) {
+            send_slots[i] = (char*) aligned_alloc(4096, slot_size);
+            recv_slots[i] = (char*) aligned_alloc(4096, slot_size);
+            send_iov[i] = {send_slots[i], slot_size};
+            recv_iov[i] = {recv_slots[i], slot_size};
+        }
+        send_ring.register_buffers(send_iov, 2);
+        recv_ring.register_buffers(recv_iov, 2);
+        submit_read(1 - recv_cur);
+    }
+
+    ~UringIO() override {
+        flush();
+        wait_write();
+        // Cancel the read ahead, and wait for it before its buffer goes away
+        struct io_uring_sqe* sqe = recv_ring.get_sqe();
+        sqe->opcode = IORING_OP_ASYNC_CANCEL;
+        sqe->addr = READ_TAG;
+        sqe->user_data = CANCEL_TAG;
+        recv_ring.submit(0);
+        struct io_uring_cqe cqe;
+        for(int done = read_in_flight ? 0 : 1; done < 2; done++) {
+            recv_ring.wait(cqe);
+        }
+        for(int i = 0; i < 2; i++) {
+            free(send_slots[i]);
+            free(recv_slots[i]);
+        }
+    }
+
+    void send_data(const void* data, size_t len, bool buffered = true) override {
+        send_counter += len;
+        append(data, len);
+        if (!buffered) {
+            submit_fill();
+        } else {
+            has_sent = true;
+        }
+    }
+
+    void send_frame(const void* header, size_t header_len,
+            const void* payload, size_t payload_len) override {
+        if (!copy_frame(header, header_len, payload, payload_len)) {
+            // The payload belongs to the caller, so wait for both operations
+            submit_frame(payload, payload_len, nullptr);
+            wait_write();
+        }
+    }
+
+    void send_frame_async(const void* header, size_t header_len,
+            const void* payload, size_t payload_len, std::function<void()> release) override {
+        if (copy_frame(header, header_len, payload, payload_len)) {
+            release();
+            return;
+        }
+        submit_frame(payload, payload_len, std::move(release));
+    }
+
+    // Every byte is written through the ring, never with MSG_ZEROCOPY
+    bool set_zerocopy(bool enable) override {
+        return !enable;
+    }
+
+    size_t recv_data(void* data, size_t len, bool buffered = true) override {
+        if (has_sent) flush();
+        recv_counter += len;
+        char* dst = (char*) data;
+        size_t received = 0;
+        while (received < len) {
+            if (recv_pos == recv_end) {
+                if (!read_in_flight) break;
+                // Take the buffer of the read in flight
+                struct io_uring_cqe cqe;
+                recv_ring.wait(cqe);
+                read_in_flight = false;
+                if (cqe.res <= 0) {
+                    fprintf(stderr,"error: uring_recv_data %d\n", cqe.res);
+                    break;
+                }
+                recv_cur = 1 - recv_cur;
+                recv_pos = 0;
+                recv_end = cqe.res;
+                size_t rest = len - received - std::min(len - received, recv_end - recv_pos);
+                if (rest >= URING_COPY_SIZE) {
+                    // Drain the buffer, and receive the rest without a copy
+                    // before reading ahead again
+                    memcpy(dst + received, recv_slots[recv_cur], recv_end);
+                    received += recv_end;
+                    recv_pos = recv_end;
+                    size_t n = recv_direct(dst + received, rest);
+                    received += n;
+                    if (n < rest) break;
+                    submit_read(1 - recv_cur);
+                    continue;
+                }
+                // Read ahead into the drained one
+                submit_read(1 - recv_cur);
+            }
+            size_t n = std::min(len - received, recv_end - recv_pos);
+            memcpy(dst + received, recv_slots[recv_cur] + recv_pos, n);
+            recv_pos += n;
+            received += n;
+        }
+        return received;
+    }
+
+    void flush() override {
+        submit_fill();
+    }
+
+    uint64_t enter_calls() const {
+        return send_ring.enter_calls + recv_ring.enter_calls;
+    }
+
+private:
+    // Payloads of frames up to this size are copied into the send buffer
+    static const size_t URING_COPY_SIZE = 1 << 16;
+    static const uint64_t WRITE_TAG = 1;
+    static const uint64_t PAYLOAD_TAG = 2;
+    static const uint64_t READ_TAG = 3;
+    static const uint64_t CANCEL_TAG = 4;
+    static const uint64_t RECV_TAG = 5;
+
+    void append(const void* data, size_t len) {
+        const char* src = (const char*) data;
+        while (len > 0) {
+            size_t n = std::min(len, slot_size - fill_len);
+            memcpy(send_slots[fill] + fill_len, src, n);
+            fill_len += n;
+            src += n;
+            len -= n;
+            if (fill_len == slot_size) submit_fill();
+        }
+    }
+
+    void prepare_write(struct io_uring_sqe* sqe, int slot, size_t offset, size_t len) {
+        sqe->opcode = IORING_OP_WRITE_FIXED;
+        sqe->fd = consocket;
+        sqe->addr = (uint64_t) (send_slots[slot] + offset);
+        sqe->len = len;
+        sqe->off = (uint64_t) -1;
+        sqe->buf_index = slot;
+        sqe->user_data = WRITE_TAG;
+    }
+
+    // Appends the frame to the send buffer and starts writing it, if the
+    // payload is small enough to be cheaper to copy than to send on its own
+    bool copy_frame(const void* header, size_t header_len,
+            const void* payload, size_t payload_len) {
+        send_counter += header_len + payload_len;
+        append(header, header_len);
+        if (payload_len > slot_size - fill_len || payload_len > URING_COPY_SIZE) {
+            return false;
+        }
+        append(payload, payload_len);
+        submit_fill();
+        return true;
+    }
+
+    // Starts writing the filled buffer, once the previous write is done, and
+    // switches to the other buffer
+    void submit_fill() {
+        has_sent = false;
+        if (fill_len == 0) return;
+        submit_frame(nullptr, 0, nullptr);
+    }
+
+    // Starts writing the filled buffer followed by payload, once the previous
+    // write is done, and switches to the other buffer. release is called once
+    // the payload is sent.
+    void submit_frame(const void* payload, size_t payload_len, std::function<void()> release) {
+        wait_write();
+        write_slot = fill;
+        write_offset = 0;
+        write_len = fill_len;
+        this->payload = (const char*) payload;
+        this->payload_len = payload_len;
+        this->release = std::move(release);
+        submit_write();
+        fill = 1 - fill;
+        fill_len = 0;
+        has_sent = false;
+    }
+
+    // Submits the rest of the write in flight: the filled buffer, linked to
+    // the send of the payload
+    void submit_write() {
+        cqes_pending = 0;
+        struct io_uring_sqe* sqe = nullptr;
+        if (write_len > 0) {
+            sqe = send_ring.get_sqe();
+            prepare_write(sqe, write_slot, write_offset, write_len);
+            cqes_pending++;
+        }
+        if (payload_len > 0) {
+            if (sqe != nullptr) sqe->flags |= IOSQE_IO_LINK;
+            sqe = send_ring.get_sqe();
+            sqe->opcode = IORING_OP_SEND;
+            sqe->fd = consocket;
+            sqe->addr = (uint64_t) payload;
+            sqe->len = std::min(payload_len, (size_t) 1 << 30);
+            sqe->msg_flags = MSG_WAITALL;
+            sqe->user_data = PAYLOAD_TAG;
+            cqes_pending++;
+        }
+        send_ring.submit(0);
+        write_in_flight = true;
+    }
+
+    // Waits for the write in flight, writes the rest after a short write,
+    // which cancels the linked send, and releases the payload once sent
+    void wait_write() {
+        while (write_in_flight) {
+            struct io_uring_cqe cqe;
+            send_ring.wait(cqe);
+            cqes_pending--;
+            if (cqe.res < 0 && cqe.res != -ECANCELED) {
+                fprintf(stderr,"error: uring_send_data %d\n", cqe.res);
+                write_len = 0;
+                payload_len = 0;
+            } else if (cqe.res > 0 && cqe.user_data == PAYLOAD_TAG) {
+                payload += cqe.res;
+                payload_len -= cqe.res;
+            } else if (cqe.res > 0) {
+                write_offset += cqe.res;
+                write_len -= cqe.res;
+            }
+            if (cqes_pending > 0) continue;
+            if (write_len > 0 || payload_len > 0) {
+                submit_write();
+                continue;
+            }
+            write_in_flight = false;
+            if (release) {
+                release();
+                release = nullptr;
+            }
+        }
+    }
+
+    void submit_read(int slot) {
+        struct io_uring_sqe* sqe = recv_ring.get_sqe();
+        sqe->opcode = IORING_OP_READ_FIXED;
+        sqe->fd = consocket;
+        sqe->addr = (uint64_t) recv_slots[slot];
+        sqe->len = slot_size;
+        sqe->off = (uint64_t) -1;
+        sqe->buf_index = slot;
+        sqe->user_data = READ_TAG;
+        recv_ring.submit(0);
+        read_in_flight = true;
+    }
+
+    // Receives len bytes into data, while no read ahead is in flight
+    size_t recv_direct(char* data, size_t len) {
+        size_t received = 0;
+        while (received < len) {
+            struct io_uring_sqe* sqe = recv_ring.get_sqe();
+            sqe->opcode = IORING_OP_RECV;
+            sqe->fd = consocket;
+            sqe->addr = (uint64_t) (data + received);
+            sqe->len = std::min(len - received, (size_t) 1 << 30);
+            sqe->msg_flags = MSG_WAITALL;
+            sqe->user_data = RECV_TAG;
+            recv_ring.submit(1);
+            struct io_uring_cqe cqe;
+            recv_ring.wait(cqe);
+            if (cqe.res <= 0) {
+                fprintf(stderr,"error: uring_recv_data %d\n", cqe.res);
+                break;
+            }
+            received += cqe.res;
+        }
+        return received;
+    }
+
+    Uring send_ring;
+    Uring recv_ring;
+    size_t slot_size;
+    char* send_slots[2];
+    char* recv_slots[2];
+    // Send buffer being filled, and the write in flight with the payload
+    // linked to it
+    int fill = 0;
+    size_t fill_len = 0;
+    bool write_in_flight = false;
+    int cqes_pending = 0;
+    int write_slot = 0;
+    size_t write_offset = 0, write_len = 0;
+    const char* payload = nullptr;
+    size_t payload_len = 0;
+    std::function<void()> release;
+    // Receive buffer being drained; the read in flight fills the other one
+    int recv_cur = 0;
+    size_t recv_pos = 0, recv_end = 0;
+    bool read_in_flight = false;
+};
+}
+#endif // URING_IO_H__
@@ -0,0 +1,229 @@
+#ifndef WAN_IO_H__
+#define WAN_IO_H__
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <random>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <set>
+#include "emp-tool/io/io-channel.h"
+
+// Buffered bytes sent on as one packet of the emulated link
+#define WAN_CHUNK_SIZE (1 << 16)
+// Bytes the link takes at full speed after being idle
+#define WAN_BURST_SIZE (1 << 16)
+// Bytes sent but not yet delivered before the sender blocks, like the
+// socket buffer that bounds the bytes in flight of a TCP connection
+#define WAN_QUEUE_SIZE (1 << 22)
+
+namespace emp {
+// Wraps a channel, such as a NetIO over loopback or a SharedMemIO, in an
+// emulated wide-area link, so that benchmarks on one host see the costs of
+// round trips and limited bandwidth without tc or netem. Sent data leaves
+// through a token bucket refilled at the bandwidth, and a delay queue holds
+// it for the one-way latency plus a random jitter before a thread passes it
+// to the wrapped channel. Jitter never reorders data. Received data comes
+// straight from the wrapped channel, so both parties wrap their channel to
+// delay both directions. Takes ownership of the wrapped channel.
+// Like the kernel with the data in a socket's buffer, the link still
+// delivers the packets it holds when the process exits.
+class WanIO: public IOChannel {
+public:
+    // bandwidth in Mbit/s, 0 for unlimited, and latency and jitter in ms
+    WanIO(IOChannel* io, double bandwidth_mbps, double latency_ms, double jitter_ms = 0) {
+        start(io, bandwidth_mbps, latency_ms, jitter_ms);
+    }
+
+    // Link given as "bandwidth:latency[:jitter]", like "100:20:2"
+    WanIO(IOChannel* io, const char* spec) {
+        double bandwidth_mbps = 0, latency_ms = 0, jitter_ms = 0;
+        if (sscanf(spec, "%lf:%lf:%lf", &bandwidth_mbps, &latency_ms, &jitter_ms) < 2) {
+            fprintf(stderr, "error: WAN link %s is not bandwidth:latency[:jitter]\n", spec);
+            exit(1);
+        }
+        start(io, bandwidth_mbps, latency_ms, jitter_ms);
+    }
+
+    ~WanIO() override {
+        {
+            Registry& registry = live();
+            std::lock_guard<std::mutex> lock(registry.mutex);
+            registry.channels.erase(this);
+        }
+        flush();
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            stop = true;
+        }
+        queue_cond.notify_all();
+        delivery.join();
+        delete io;
+    }
+
+    void send_data(const void* data, size_t len, bool buffered = true) override {
+        send_counter += len;
+        const char* src = (const char*) data;
+        std::unique_lock<std::mutex> lock(mutex);
+        while (len > 0) {
+            size_t n = std::min(len, (size_t) WAN_CHUNK_SIZE - std::min(pending.size(), (size_t) WAN_CHUNK_SIZE));
+            pending.insert(pending.end(), src, src + n);
+            src += n;
+            len -= n;
+            if (pending.size() >= WAN_CHUNK_SIZE) enqueue(lock);
+        }
+        if (!buffered) {
+            enqueue(lock);
+        } else if (!pending.empty()) {
+            has_sent = true;
+        }
+    }
+
+    size_t recv_data(void* data, size_t len, bool buffered = true) override {
+        if (has_sent) flush();
+        size_t received = io->recv_data(data, len, buffered);
+        recv_counter += received;
+        return received;
+    }
+
+    void flush() override {
+        std::unique_lock<std::mutex> lock(mutex);
+        enqueue(lock);
+    }
+
+    // Header and payload leave as one packet, behind the buffered data
+    void send_frame(const void* header, size_t header_len,
+            const void* payload, size_t payload_len) override {
+        send_counter += header_len + payload_len;
+        std::unique_lock<std::mutex> lock(mutex);
+        pending.insert(pending.end(), (const char*) header, (const char*) header + header_len);
+        pending.insert(pending.end(), (const char*) payload, (const char*) payload + payload_len);
+        enqueue(lock);
+    }
+
+private:
+    typedef std::chrono::steady_clock Clock;
+
+    struct Packet {
+        Clock::time_point arrival;
+        std::vector<char> data;
+    };
+
+    struct Registry {
+        std::mutex mutex;
+        std::set<WanIO*> channels;
+    };
+
+    // Links not destroyed yet. The registry is made before deliver_at_exit
+    // is registered, so it outlives the call.
+    static Registry& live() {
+        static Registry registry;
+        static bool registered = (atexit(deliver_at_exit) == 0);
+        (void) registered;
+        return registry;
+    }
+
+    static void deliver_at_exit() {
+        Registry& registry = live();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        for(WanIO* wan : registry.channels) {
+            std::unique_lock<std::mutex> wan_lock(wan->mutex);
+            wan->space_cond.wait(wan_lock, [&]() { return wan->queued_bytes == 0; });
+        }
+    }
+
+    void start(IOChannel* io, double bandwidth_mbps, double latency_ms, double jitter_ms) {
+        this->io = io;
+        is_server = io->is_server;
+        // Nanoseconds per byte, and the latencies in nanoseconds
+        ns_per_byte = (bandwidth_mbps > 0) ? 8e3 / bandwidth_mbps : 0;
+        latency = std::chrono::nanoseconds((int64_t) (latency_ms * 1e6));
+        jitter = std::uniform_int_distribution<int64_t>(0, (int64_t) (jitter_ms * 1e6));
+        burst = std::chrono::nanoseconds((int64_t) (WAN_BURST_SIZE * ns_per_byte));
+        link_free = last_arrival = Clock::now();
+        delivery = std::thread([this]() { run(); });
+        Registry& registry = live();
+        std::lock_guard<std::mutex> lock(registry.mutex);
+        registry.channels.insert(this);
+    }
+
+    // Hands the pending data to the link as one packet. The sending thread
+    // and a receiving thread that flushes share pending under lock, and
+    // pending is only taken once the link has room for it, so that packets
+    // enter the link in the order their data was sent.
+    void enqueue(std::unique_lock<std::mutex>& lock) {
+        space_cond.wait(lock, [&]() {
+            return pending.empty() || queued_bytes == 0
+                || queued_bytes + pending.size() <= WAN_QUEUE_SIZE;
+        });
+        has_sent = false;
+        if (pending.empty()) return;
+        size_t len = pending.size();
+        // Token bucket: the link may have saved up to a burst while idle,
+        // and then sends at the bandwidth
+        Clock::time_point now = Clock::now();
+        link_free = std::max(link_free, now - burst);
+        link_free += std::chrono::nanoseconds((int64_t) (len * ns_per_byte));
+        Clock::time_point arrival = std::max(link_free, now) + latency
+            + std::chrono::nanoseconds(jitter(rng));
+        last_arrival = std::max(last_arrival, arrival);
+        packets.push_back({last_arrival, std::move(pending)});
+        pending = std::vector<char>();
+        queued_bytes += len;
+        queue_cond.notify_all();
+    }
+
+    // Passes every packet on to the wrapped channel once it arrives
+    void run() {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            queue_cond.wait(lock, [&]() { return stop || !packets.empty(); });
+            if (packets.empty()) break;
+            Clock::time_point arrival = packets.front().arrival;
+            if (Clock::now() < arrival) {
+                // Packets behind the front arrive later, so new ones do
+                // not matter
+                lock.unlock();
+                std::this_thread::sleep_until(arrival);
+                lock.lock();
+            }
+            Packet packet = std::move(packets.front());
+            packets.pop_front();
+            lock.unlock();
+            io->send_data(packet.data.data(), packet.data.size(), false);
+            lock.lock();
+            queued_bytes -= packet.data.size();
+            space_cond.notify_all();
+        }
+    }
+
+    IOChannel* io = nullptr;
+    double ns_per_byte = 0;
+    std::chrono::nanoseconds latency{0};
+    std::chrono::nanoseconds burst{0};
+    std::uniform_int_distribution<int64_t> jitter;
+    std::mt19937_64 rng{std::random_device()()};
+    // Buffered data of the sender, not handed to the link yet, under mutex
+    std::vector<char> pending;
+    std::atomic<bool> has_sent{false};
+
+    std::thread delivery;
+    std::mutex mutex;
+    std::condition_variable queue_cond;
+    std::condition_variable space_cond;
+    std::deque<Packet> packets;
+    size_t queued_bytes = 0;
+    bool stop = false;
+    // Time the link finishes sending the data queued so far, and arrival
+    // of the last packet
+    Clock::time_point link_free;
+    Clock::time_point last_arrival;
+};
+}
+#endif // WAN_IO_H__
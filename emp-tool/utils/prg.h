@@ -5,6 +5,8 @@
 #include "emp-tool/utils/constants.h"
 #include <gmp.h>
 #include <random>
+#include <atomic>
+#include <thread>
 #include <x86intrin.h>
 
 /** @addtogroup BP
@@ -18,6 +20,11 @@ class PRG { public:
 	PRG(const void * seed = nullptr, int id = 0) {	
 		if (seed != nullptr) {
 			reseed(seed, 16, id);
+		} else if (default_seed().is_set) {
+			DefaultSeed& fixed = default_seed();
+			uint64_t fixed_id = (std::this_thread::get_id() == fixed.owner)
+				? owner_count()++ : ((1ULL << 63) | fixed.other_count++);
+			reseed(&fixed.seed, 16, fixed_id);
 		} else {
 			Label v;
 			unsigned long long r0, r1, r2, r3;
@@ -30,6 +37,24 @@ class PRG { public:
 			reseed(&v, 32);
 		}
 	}
+	// Seeds the PRGs constructed without a seed from now on, so that a run
+	// can be repeated, e.g. to replay a recorded transcript. The n-th such
+	// PRG of the calling thread takes id n. PRGs of other threads take ids
+	// in the order they are made, which may differ between runs. Only for
+	// benchmarks and tests: anyone who knows seed can predict the PRGs,
+	// and with them the keys and encryptions of PQOT.
+	static void set_default_seed(const block& seed) {
+		DefaultSeed& fixed = default_seed();
+		fixed.seed = seed;
+		fixed.owner = std::this_thread::get_id();
+		owner_count() = 0;
+		fixed.is_set = true;
+	}
+
+	static bool has_default_seed() {
+		return default_seed().is_set;
+	}
+
 	void reseed(const void * key, int keylen = 16, uint64_t id = 0) {
 		block u = _mm_loadu_si128((block*) key);
         block v;
@@ -109,6 +134,24 @@ class PRG { public:
 			}
 		}
 	}
+
+private:
+	struct DefaultSeed {
+		std::atomic<bool> is_set{false};
+		block seed;
+		std::thread::id owner;
+		std::atomic<uint64_t> other_count{0};
+	};
+
+	static DefaultSeed& default_seed() {
+		static DefaultSeed fixed;
+		return fixed;
+	}
+
+	static uint64_t& owner_count() {
+		static uint64_t count = 0;
+		return count;
+	}
 };
 }
 /**@}*/
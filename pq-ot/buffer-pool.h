@@ -0,0 +1,204 @@
+#ifndef PQ_OT_BUFFER_POOL_H__
+#define PQ_OT_BUFFER_POOL_H__
+#include <cstdlib>
+#include <cstring>
+#include <cstdint>
+#include <mutex>
+#include <vector>
+#include <atomic>
+#include <streambuf>
+#include <istream>
+#include <ostream>
+#include <algorithm>
+
+// Smallest buffer handed out by the pool, as a power of two
+#define BUFFER_POOL_MIN_LOG 8
+#define BUFFER_POOL_NUM_CLASSES 40
+// Bytes of free buffers the pool keeps for reuse
+#define BUFFER_POOL_MAX_BYTES (256ULL << 20)
+
+// Process-wide pool of message buffers, in power-of-two size classes, so
+// that the ciphertexts of every call reuse the memory of earlier calls.
+// Freed buffers beyond BUFFER_POOL_MAX_BYTES go back to the allocator.
+class BufferPool {
+public:
+    static BufferPool& instance() {
+        static BufferPool pool;
+        return pool;
+    }
+
+    // Returns a buffer of at least size bytes, and its capacity
+    char* acquire(uint64_t size, uint64_t& capacity) {
+        int size_class = class_of(size);
+        capacity = 1ULL << (size_class + BUFFER_POOL_MIN_LOG);
+        {
+            std::lock_guard<std::mutex> lock(mutex_[size_class]);
+            if (!free_[size_class].empty()) {
+                char* data = free_[size_class].back();
+                free_[size_class].pop_back();
+                free_bytes_ -= capacity;
+                return data;
+            }
+        }
+        return (char*) malloc(capacity);
+    }
+
+    void release(char* data, uint64_t capacity) {
+        if (free_bytes_ + capacity <= BUFFER_POOL_MAX_BYTES) {
+            int size_class = class_of(capacity);
+            std::lock_guard<std::mutex> lock(mutex_[size_class]);
+            free_[size_class].push_back(data);
+            free_bytes_ += capacity;
+            return;
+        }
+        free(data);
+    }
+
+    ~BufferPool() {
+        for(int i = 0; i < BUFFER_POOL_NUM_CLASSES; i++) {
+            for(char* data : free_[i]) {
+                free(data);
+            }
+        }
+    }
+
+private:
+    BufferPool() = default;
+
+    static int class_of(uint64_t size) {
+        int size_class = 0;
+        while ((1ULL << (size_class + BUFFER_POOL_MIN_LOG)) < size) {
+            size_class++;
+        }
+        return size_class;
+    }
+
+    std::mutex mutex_[BUFFER_POOL_NUM_CLASSES];
+    std::vector<char*> free_[BUFFER_POOL_NUM_CLASSES];
+    std::atomic<uint64_t> free_bytes_{0};
+};
+
+// Message buffer taken from the pool. Buffers are move-only, so a message has
+// a single owner at any time: the job that serializes it hands it to the send
+// thread, and the receive thread to the job that reads it. The buffer goes
+// back to the pool when its owner drops it.
+class Buffer {
+public:
+    Buffer() = default;
+
+    explicit Buffer(uint64_t size) {
+        data_ = BufferPool::instance().acquire(size, capacity_);
+        size_ = size;
+    }
+
+    // Copy of size bytes from data
+    Buffer(const char* data, uint64_t size) : Buffer(size) {
+        memcpy(data_, data, size);
+    }
+
+    Buffer(Buffer&& other) noexcept {
+        *this = std::move(other);
+    }
+
+    Buffer& operator=(Buffer&& other) noexcept {
+        if (this != &other) {
+            release();
+            data_ = other.data_;
+            size_ = other.size_;
+            capacity_ = other.capacity_;
+            other.data_ = nullptr;
+            other.size_ = other.capacity_ = 0;
+        }
+        return *this;
+    }
+
+    Buffer(const Buffer&) = delete;
+    Buffer& operator=(const Buffer&) = delete;
+
+    ~Buffer() {
+        release();
+    }
+
+    char* data() { return data_; }
+    const char* data() const { return data_; }
+    uint64_t size() const { return size_; }
+    uint64_t capacity() const { return capacity_; }
+
+    // Resize, keeping the contents. Moves to a larger buffer of the pool if
+    // the capacity does not suffice.
+    void resize(uint64_t size) {
+        if (size > capacity_) {
+            Buffer larger(size);
+            if (size_ > 0) memcpy(larger.data_, data_, size_);
+            *this = std::move(larger);
+        }
+        size_ = size;
+    }
+
+    void release() {
+        if (data_ != nullptr) {
+            BufferPool::instance().release(data_, capacity_);
+            data_ = nullptr;
+            size_ = capacity_ = 0;
+        }
+    }
+
+private:
+    char* data_ = nullptr;
+    uint64_t size_ = 0;
+    uint64_t capacity_ = 0;
+};
+
+// Output stream serializing into a pooled buffer, which grows as needed, so
+// that a ciphertext is written once and handed over without a copy
+class BufferOutStream : private std::streambuf, public std::ostream {
+public:
+    explicit BufferOutStream(uint64_t size_hint = 0) : std::ostream(this) {
+        buffer.resize(size_hint);
+        buffer.resize(0);
+    }
+
+    // Take the serialized bytes, leaving the stream empty
+    Buffer take() {
+        return std::move(buffer);
+    }
+
+protected:
+    std::streamsize xsputn(const char* s, std::streamsize n) override {
+        uint64_t offset = buffer.size();
+        reserve(offset + n);
+        buffer.resize(offset + n);
+        memcpy(buffer.data() + offset, s, n);
+        return n;
+    }
+
+    std::streambuf::int_type overflow(std::streambuf::int_type c) override {
+        typedef std::streambuf::traits_type traits;
+        if (c != traits::eof()) {
+            char ch = traits::to_char_type(c);
+            xsputn(&ch, 1);
+        }
+        return traits::not_eof(c);
+    }
+
+private:
+    // Grow geometrically, so that a message takes few moves
+    void reserve(uint64_t size) {
+        if (size > buffer.capacity()) {
+            uint64_t offset = buffer.size();
+            buffer.resize(std::max(size, 2 * buffer.capacity()));
+            buffer.resize(offset);
+        }
+    }
+
+    Buffer buffer;
+};
+
+// Input stream reading a buffer in place
+class BufferInStream : private std::streambuf, public std::istream {
+public:
+    explicit BufferInStream(Buffer& buffer) : std::istream(this) {
+        setg(buffer.data(), buffer.data(), buffer.data() + buffer.size());
+    }
+};
+#endif //PQ_OT_BUFFER_POOL_H__
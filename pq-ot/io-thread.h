@@ -3,60 +3,31 @@
 #include <emp-tool/emp-tool.h>
 #include <pthread.h>
 #include <queue>
+#include <map>
 #include <mutex>
 #include <condition_variable>
-
-#define ADMIN_CHANNEL 255
-
-// ConcurrentQueue implementation taken from
-// https://juanchopanzacpp.wordpress.com/2013/02/26/concurrent-queue-c11/
-template <typename T>
-class ConcurrentQueue
-{
-public:
-    T pop() {
-        std::unique_lock<std::mutex> mlock(mutex_);
-        while (queue_.empty()) {
-            cond_.wait(mlock);
-        }
-        auto val = queue_.front();
-        queue_.pop();
-        return val;
+#include <atomic>
+#include <chrono>
+#include "pq-ot/lockfree-queue.h"
+#include "pq-ot/buffer-pool.h"
+
+// Channel ids are 16-bit, and the largest one ends a call
+#define ADMIN_CHANNEL 0xFFFF
+// Every message starts with its channel id, sequence number and length
+#define FRAME_HEADER_SIZE (sizeof(uint16_t) + sizeof(uint32_t) + sizeof(uint64_t))
+
+// Locks m, and adds the time spent waiting for another thread to release it
+// to wait_ns. Uncontended locks are not timed.
+inline std::unique_lock<std::mutex> lock_timed(std::mutex& m, std::atomic<uint64_t>& wait_ns) {
+    std::unique_lock<std::mutex> lock(m, std::try_to_lock);
+    if (!lock.owns_lock()) {
+        auto start = std::chrono::steady_clock::now();
+        lock.lock();
+        wait_ns += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now() - start).count();
     }
-
-    void pop(T& item) {
-        std::unique_lock<std::mutex> mlock(mutex_);
-        while (queue_.empty()) {
-            cond_.wait(mlock);
-        }
-        item = queue_.front();
-        queue_.pop();
-    }
-
-    void push(const T& item) {
-        std::unique_lock<std::mutex> mlock(mutex_);
-        queue_.push(item);
-        mlock.unlock();
-        cond_.notify_one();
-    }
-
-    void flush() {
-        std::unique_lock<std::mutex> mlock(mutex_);
-        while (!queue_.empty()) {
-            queue_.pop();
-        }
-        mlock.unlock();
-    }
-
-    ConcurrentQueue()=default;
-    ConcurrentQueue(const ConcurrentQueue&) = delete;            // disable copying
-    ConcurrentQueue& operator=(const ConcurrentQueue&) = delete; // disable assignment
-
-private:
-    std::queue<T> queue_;
-    std::mutex mutex_;
-    std::condition_variable cond_;
-};
+    return lock;
+}
 
 class BaseThread {
 public:
@@ -103,139 +74,418 @@ protected:
 };
 
 struct SendTask{
-    uint8_t channel_id;
-    uint64_t length;
-    char* data;
+    uint16_t channel_id;
+    uint32_t seq;
+    Buffer data;
+    // Stops the thread without sending anything
+    bool stop = false;
+};
+
+// Payloads of frames the connection may still be reading, each in a slot
+// until it releases them. Freed slots are reused, and a release callback only
+// holds the slots and an index, which std::function stores without
+// allocating. Slots are released in any order, since a small frame goes at
+// once while an earlier zero-copy one is still in flight. The connection may
+// outlive the thread, so once orphaned the slots go with the last release.
+class InFlightFrames {
+public:
+    // Keeps data in a free slot, and returns where the payload is
+    const char* hold(Buffer&& data, uint32_t& slot) {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (free_slots.empty()) {
+            slot = slots.size();
+            slots.push_back(std::move(data));
+        } else {
+            slot = free_slots.back();
+            free_slots.pop_back();
+            slots[slot] = std::move(data);
+        }
+        return slots[slot].data();
+    }
+
+    void release(uint32_t slot) {
+        std::unique_lock<std::mutex> lock(mutex);
+        slots[slot] = Buffer();
+        free_slots.push_back(slot);
+        if (orphaned && free_slots.size() == slots.size()) {
+            lock.unlock();
+            delete this;
+        }
+    }
+
+    // Called instead of delete by the owner, which no longer holds frames
+    void orphan() {
+        std::unique_lock<std::mutex> lock(mutex);
+        orphaned = true;
+        if (free_slots.size() == slots.size()) {
+            lock.unlock();
+            delete this;
+        }
+    }
+
+private:
+    std::mutex mutex;
+    std::vector<Buffer> slots;
+    std::vector<uint32_t> free_slots;
+    bool orphaned = false;
 };
 
-// Sends a message on a particular channel
+// Sends a message on a particular channel. The thread lives as long as the
+// object, and every call ends with a message on ADMIN_CHANNEL.
 class SendThread: public BaseThread {
 public:
-    SendThread(emp::NetIO* io) {
+    SendThread(emp::IOChannel* io) {
         this->io = io;
     }
 
     ~SendThread() {
-        signal_end();
-        this->wait();
+        stop();
+        in_flight->orphan();
     }
 
-    void add_task(uint8_t channel_id, uint64_t length, const char* data) {
+    // Takes over data, which goes back to the pool once it is sent
+    void add_task(uint16_t channel_id, Buffer&& data, uint32_t seq = 0) {
         SendTask task;
         task.channel_id = channel_id;
-        task.length = length;
-        task.data = (char*) malloc(task.length);
-        memcpy(task.data, data, task.length);
+        task.seq = seq;
+        task.data = std::move(data);
+
+        tasks.push(std::move(task));
+    }
 
-        tasks.push(task);
+    void add_task(uint16_t channel_id, uint64_t length, const char* data, uint32_t seq = 0) {
+        add_task(channel_id, Buffer(data, length), seq);
     }
 
+    // Ends the current call on the other side
     void signal_end() {
-        char dummy_val;
-        uint8_t channel_id = ADMIN_CHANNEL;
-        add_task(channel_id, 0, &dummy_val);
+        uint16_t channel_id = ADMIN_CHANNEL;
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        ends_queued++;
+        lock.unlock();
+        add_task(channel_id, Buffer());
+    }
+
+    // Blocks until every message up to the last signal_end has been sent
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock(idle_mutex);
+        while(ends_sent < ends_queued) {
+            idle_cond.wait(lock);
+        }
+    }
+
+    void stop() {
+        if (!is_running()) return;
+        SendTask task;
+        task.stop = true;
+        tasks.push(std::move(task));
+        this->wait();
     }
 
     uint64_t get_send_count() {
         return io->send_counter;
     }
 
+    // Time the threads adding tasks spent waiting for room in the queue, in
+    // nanoseconds
+    uint64_t lock_wait_time() const {
+        return tasks.wait_time();
+    }
+
     void run() {
-        uint8_t channel_id;
-        bool run = true;
-        while(run) {
+        uint16_t channel_id;
+        while(true) {
             SendTask task = tasks.pop();
-
-            channel_id = task.channel_id;
-            io->send_data(&channel_id, sizeof(uint8_t), false);
-            io->send_data(&task.length, sizeof(uint64_t), false);
-            if(task.length > 0) {
-                io->send_data(task.data, task.length, false);
+            if(task.stop) {
+                break;
             }
 
-            free(task.data);
+            // Header and payload leave in a single write, or without a copy
+            // of the payload, which then stays with the connection until
+            // the kernel is done with it
+            channel_id = task.channel_id;
+            uint64_t length = task.data.size();
+            char header[FRAME_HEADER_SIZE];
+            memcpy(header, &channel_id, sizeof(uint16_t));
+            memcpy(header + sizeof(uint16_t), &task.seq, sizeof(uint32_t));
+            memcpy(header + sizeof(uint16_t) + sizeof(uint32_t), &length, sizeof(uint64_t));
+            uint32_t slot;
+            const char* payload = in_flight->hold(std::move(task.data), slot);
+            InFlightFrames* frames = in_flight;
+            io->send_frame_async(header, FRAME_HEADER_SIZE, payload, length,
+                    [frames, slot]() { frames->release(slot); });
 
             if(channel_id == ADMIN_CHANNEL) {
-                run = false;
+                std::unique_lock<std::mutex> lock(idle_mutex);
+                ends_sent++;
+                idle_cond.notify_all();
             }
         }
     }
 
 private:
-    emp::NetIO* io;
-    ConcurrentQueue<SendTask> tasks;
+    emp::IOChannel* io;
+    // Filled by the worker threads, drained by this thread
+    MPSCQueue<SendTask> tasks;
+    InFlightFrames* in_flight = new InFlightFrames();
+    std::mutex idle_mutex;
+    std::condition_variable idle_cond;
+    uint64_t ends_queued = 0;
+    uint64_t ends_sent = 0;
 };
 
-struct RecvTask {
-    char *data;
-    uint64_t length;
+// Messages of a channel, retrieved by sequence number so that they can be
+// sent in any order. Messages with the same sequence number are retrieved in
+// the order in which they arrived. The IO thread is the only producer and the
+// thread running the call on the channel the only consumer, so messages pass
+// through a lock-free queue, and the consumer sets aside the messages that
+// arrive before the one it is waiting for.
+class SequencedQueue {
+public:
+    Buffer pop(uint32_t seq) {
+        auto it = early_.find(seq);
+        if (it != early_.end()) {
+            Buffer data = std::move(it->second.front());
+            it->second.pop();
+            if (it->second.empty()) {
+                early_.erase(it);
+            }
+            return data;
+        }
+        while (true) {
+            SequencedMessage next = queue_.pop();
+            if (next.seq == seq) {
+                return std::move(next.data);
+            }
+            early_[next.seq].push(std::move(next.data));
+        }
+    }
+
+    void push(uint32_t seq, Buffer&& data) {
+        SequencedMessage next;
+        next.seq = seq;
+        next.data = std::move(data);
+        queue_.push(std::move(next));
+    }
+
+    // Return the messages nobody retrieved to the pool
+    void flush() {
+        SequencedMessage next;
+        while (queue_.try_pop(next)) {}
+        early_.clear();
+    }
+
+private:
+    struct SequencedMessage {
+        uint32_t seq;
+        Buffer data;
+    };
+
+    SPSCQueue<SequencedMessage> queue_;
+    // Only used by the consumer
+    std::map<uint32_t, std::queue<Buffer>> early_;
 };
 
-// Listens for messages on num_threads many channels, and stores them in the
-// corresponding concurrent queues, which can later be retrieved using channel_id
+// Listens for messages on num_channels many channels, and stores them in the
+// corresponding queues, which can later be retrieved using channel_id and seq.
+// The thread lives as long as the object but only reads from io while armed,
+// so that io can be used directly between calls.
 class RecvThread: public BaseThread {
 public:
-    RecvThread(emp::NetIO* io, uint8_t num_threads) {
+    RecvThread(emp::IOChannel* io, int num_channels) {
         this->io = io;
-        this->num_channels = num_threads;
+        this->num_channels = num_channels;
         this->listeners.resize(num_channels);
-        for(uint8_t i = 0; i < num_channels; i++) {
-            listeners[i] = new ConcurrentQueue<RecvTask>();
+        for(int i = 0; i < num_channels; i++) {
+            listeners[i] = new SequencedQueue();
         }
     }
 
     ~RecvThread() {
-        this->wait();
-        for(uint8_t i = 0; i < num_channels; i++) {
+        stop();
+        for(int i = 0; i < num_channels; i++) {
             listeners[i]->flush();
             delete listeners[i];
         }
         listeners.clear();
     }
 
-    RecvTask get_task(uint8_t channel_id){
-        RecvTask task = listeners[channel_id]->pop();
-        return task;
+    // The caller owns the message, and returns it to the pool by dropping it
+    Buffer get_task(uint16_t channel_id, uint32_t seq = 0){
+        return listeners[channel_id]->pop(seq);
     }
 
     uint64_t get_recv_count() {
         return io->recv_counter;
     }
 
+    // Reads messages until the other side ends one more call
+    void arm() {
+        std::unique_lock<std::mutex> lock(state_mutex);
+        armed++;
+        state_cond.notify_all();
+    }
+
+    // Blocks until the other side has ended every armed call
+    void wait_idle() {
+        std::unique_lock<std::mutex> lock(state_mutex);
+        while(armed > 0 && !stopped) {
+            state_cond.wait(lock);
+        }
+    }
+
+    // Must only be called while idle
+    void stop() {
+        std::unique_lock<std::mutex> lock(state_mutex);
+        stopped = true;
+        state_cond.notify_all();
+        lock.unlock();
+        this->wait();
+    }
+
+    // Messages are read through the buffered IO stream, which may already hold
+    // the start of the first message if it arrived with earlier buffered data
     void run() {
-        uint8_t channel_id;
+        uint16_t channel_id;
+        uint32_t seq;
         uint64_t length;
         uint64_t recv_len;
         while(true) {
+            std::unique_lock<std::mutex> lock(state_mutex);
+            while(armed == 0 && !stopped) {
+                state_cond.wait(lock);
+            }
+            if(armed == 0) {
+                return;
+            }
+            lock.unlock();
+
             recv_len = 0;
-            recv_len += io->recv_data(&channel_id, sizeof(uint8_t), false);
-            recv_len += io->recv_data(&length, sizeof(uint64_t), false);
+            recv_len += io->recv_data(&channel_id, sizeof(uint16_t), true);
+            recv_len += io->recv_data(&seq, sizeof(uint32_t), true);
+            recv_len += io->recv_data(&length, sizeof(uint64_t), true);
 
             if(recv_len > 0) {
                 if(channel_id == ADMIN_CHANNEL) {
-                    char* data = (char*) malloc(length);
-                    io->recv_data(data, length, false);
-                    free(data);
-                    return;
+                    Buffer data(length);
+                    io->recv_data(data.data(), length, true);
+                    lock.lock();
+                    armed--;
+                    state_cond.notify_all();
                 }
                 else {
-                    RecvTask task;
-                    task.data = (char*) malloc(length);
-                    task.length = length;
-
-                    io->recv_data(task.data, length, false);
-                    listeners[channel_id]->push(task);
+                    // Read straight into a pooled buffer, which the consumer
+                    // takes over
+                    Buffer data(length);
+                    io->recv_data(data.data(), length, true);
+                    listeners[channel_id]->push(seq, std::move(data));
                 }
             } else {
                 // We received 0 bytes, probably due to some major error. Just return.
+                lock.lock();
+                stopped = true;
+                state_cond.notify_all();
                 return;
             }
         }
     }
 
 private:
-    emp::NetIO* io;
-    uint8_t num_channels;
-    std::vector<ConcurrentQueue<RecvTask>*> listeners;
+    emp::IOChannel* io;
+    int num_channels;
+    std::vector<SequencedQueue*> listeners;
+    std::mutex state_mutex;
+    std::condition_variable state_cond;
+    // Number of calls the other side has not ended yet
+    int armed = 0;
+    bool stopped = false;
+};
+
+// Channels striped across several connections, each with its own IO thread,
+// so that a large message only holds up the channels of its own connection.
+// Channel c uses connection c % num_stripes, and every call ends on every
+// connection.
+class StripedSend {
+public:
+    StripedSend(const std::vector<emp::IOChannel*>& ios) {
+        for(emp::IOChannel* io : ios) {
+            SendThread* thread = new SendThread(io);
+            thread->start();
+            threads.push_back(thread);
+        }
+    }
+
+    ~StripedSend() {
+        for(SendThread* thread : threads) {
+            delete thread;
+        }
+    }
+
+    void add_task(uint16_t channel_id, Buffer&& data, uint32_t seq = 0) {
+        threads[channel_id % threads.size()]->add_task(channel_id, std::move(data), seq);
+    }
+
+    void add_task(uint16_t channel_id, uint64_t length, const char* data, uint32_t seq = 0) {
+        threads[channel_id % threads.size()]->add_task(channel_id, length, data, seq);
+    }
+
+    void signal_end() {
+        for(SendThread* thread : threads) {
+            thread->signal_end();
+        }
+    }
+
+    void wait_idle() {
+        for(SendThread* thread : threads) {
+            thread->wait_idle();
+        }
+    }
+
+    uint64_t lock_wait_time() const {
+        uint64_t total = 0;
+        for(SendThread* thread : threads) {
+            total += thread->lock_wait_time();
+        }
+        return total;
+    }
+
+private:
+    std::vector<SendThread*> threads;
+};
+
+class StripedRecv {
+public:
+    StripedRecv(const std::vector<emp::IOChannel*>& ios, int num_channels) {
+        for(emp::IOChannel* io : ios) {
+            RecvThread* thread = new RecvThread(io, num_channels);
+            thread->start();
+            threads.push_back(thread);
+        }
+    }
+
+    ~StripedRecv() {
+        for(RecvThread* thread : threads) {
+            delete thread;
+        }
+    }
+
+    Buffer get_task(uint16_t channel_id, uint32_t seq = 0) {
+        return threads[channel_id % threads.size()]->get_task(channel_id, seq);
+    }
+
+    void arm() {
+        for(RecvThread* thread : threads) {
+            thread->arm();
+        }
+    }
+
+    void wait_idle() {
+        for(RecvThread* thread : threads) {
+            thread->wait_idle();
+        }
+    }
+
+private:
+    std::vector<RecvThread*> threads;
 };
 #endif //PQ_OT_IO_THREAD_H__
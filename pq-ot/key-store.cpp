@@ -0,0 +1,119 @@
+#include "pq-ot/key-store.h"
+#include <fstream>
+#include <sstream>
+#include <ctime>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+using namespace std;
+using namespace seal;
+
+// Header of a key file, followed by the public key and, for OT Receiver, the
+// secret key
+struct KeyFileHeader {
+    int poly_degree;
+    int plain_modulus_bitlen;
+    // Creation time in seconds since the epoch
+    uint64_t created;
+    // Number of sessions that used the keys
+    uint64_t uses;
+    emp::block key_id;
+};
+
+string KeyStore::path(Cryptosystem* pkc, int role) const {
+    return directory + "/" + peer + "-" + (role == emp::ALICE ? "pk" : "keypair")
+        + "-" + to_string(pkc->poly_degree) + "-" + to_string(pkc->plain_modulus_bitlen)
+        + ".key";
+}
+
+static bool read_header(fstream& file, Cryptosystem* pkc, KeyFileHeader& header) {
+    if (!file.is_open()) return false;
+    file.read((char*) &header, sizeof(KeyFileHeader));
+    // Keys of other parameters would not load into the context of pkc
+    return file.good() && header.poly_degree == pkc->poly_degree
+        && header.plain_modulus_bitlen == pkc->plain_modulus_bitlen;
+}
+
+static void write_header(ostream& file, Cryptosystem* pkc, const emp::block& key_id) {
+    KeyFileHeader header;
+    header.poly_degree = pkc->poly_degree;
+    header.plain_modulus_bitlen = pkc->plain_modulus_bitlen;
+    header.created = time(NULL);
+    header.uses = 1;
+    header.key_id = key_id;
+    file.write((char*) &header, sizeof(KeyFileHeader));
+}
+
+// Replaces path with data. The data goes to a temporary file that only this
+// user can read, which then takes the place of path, so that a crash never
+// leaves a partly written key behind.
+static bool write_file(const string& path, const string& data) {
+    string temp = path + ".XXXXXX";
+    // mkstemp creates the file with mode 0600
+    int fd = mkstemp(&temp[0]);
+    if (fd < 0) return false;
+    size_t written = 0;
+    while (written < data.size()) {
+        ssize_t n = write(fd, data.data() + written, data.size() - written);
+        if (n <= 0) break;
+        written += n;
+    }
+    bool ok = (written == data.size()) && fsync(fd) == 0;
+    ok = (close(fd) == 0) && ok;
+    if (!ok || rename(temp.c_str(), path.c_str()) != 0) {
+        unlink(temp.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool KeyStore::load_key_pair(Cryptosystem* pkc, PublicKey& public_key,
+        SecretKey& secret_key, emp::block& key_id) {
+    fstream file(path(pkc, emp::BOB), ios::in | ios::out | ios::binary);
+    KeyFileHeader header;
+    if (!read_header(file, pkc, header)) return false;
+    uint64_t age = time(NULL) - header.created;
+    if ((policy.max_age != 0 && age >= policy.max_age)
+            || (policy.max_uses != 0 && header.uses >= policy.max_uses)) {
+        return false;
+    }
+    public_key.load(pkc->context, file);
+    secret_key.load(pkc->context, file);
+    if (!file.good()) return false;
+
+    // Count this session
+    header.uses++;
+    file.seekp(0);
+    file.write((char*) &header, sizeof(KeyFileHeader));
+    key_id = header.key_id;
+    return true;
+}
+
+bool KeyStore::save_key_pair(Cryptosystem* pkc, const PublicKey& public_key,
+        const SecretKey& secret_key, const emp::block& key_id) {
+    ostringstream file(ios::binary);
+    write_header(file, pkc, key_id);
+    public_key.save(file);
+    secret_key.save(file);
+    return write_file(path(pkc, emp::BOB), file.str());
+}
+
+bool KeyStore::load_public_key(Cryptosystem* pkc, PublicKey& public_key,
+        emp::block& key_id) {
+    fstream file(path(pkc, emp::ALICE), ios::in | ios::binary);
+    KeyFileHeader header;
+    if (!read_header(file, pkc, header)) return false;
+    public_key.load(pkc->context, file);
+    if (!file.good()) return false;
+    key_id = header.key_id;
+    return true;
+}
+
+bool KeyStore::save_public_key(Cryptosystem* pkc, const PublicKey& public_key,
+        const emp::block& key_id) {
+    ostringstream file(ios::binary);
+    write_header(file, pkc, key_id);
+    public_key.save(file);
+    return write_file(path(pkc, emp::ALICE), file.str());
+}
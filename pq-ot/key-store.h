@@ -0,0 +1,51 @@
+#ifndef PQ_OT_KEY_STORE_H__
+#define PQ_OT_KEY_STORE_H__
+#include "pq-ot/pq-otmain.h"
+#include <string>
+
+// When a stored key pair is replaced by a fresh one
+struct KeyRotationPolicy {
+    // Maximum age of a key pair in seconds, 0 for no limit
+    uint64_t max_age = 7 * 24 * 3600;
+    // Maximum number of sessions using a key pair, 0 for no limit
+    uint64_t max_uses = 1000;
+};
+
+// Keys kept on disk between sessions with the same peer, in one file per HE
+// parameter set and role: the key pair of OT Receiver, or the public key that
+// OT Sender received. A key pair is identified by a random key id, so that
+// the parties can check that they hold the same keys before reusing them.
+// The zero block is the id of no key.
+class KeyStore {
+public:
+    KeyStore(const std::string& directory, const std::string& peer,
+            KeyRotationPolicy policy = KeyRotationPolicy()) {
+        this->directory = directory;
+        this->peer = peer;
+        this->policy = policy;
+    }
+
+    // OT Receiver: load the stored key pair of pkc if the rotation policy
+    // allows one more session with it, and count that session. The saved
+    // file is readable by this user only. Saving returns false if the key
+    // could not be written, and the session then goes on with its keys in
+    // memory.
+    bool load_key_pair(Cryptosystem* pkc, seal::PublicKey& public_key,
+            seal::SecretKey& secret_key, emp::block& key_id);
+    bool save_key_pair(Cryptosystem* pkc, const seal::PublicKey& public_key,
+            const seal::SecretKey& secret_key, const emp::block& key_id);
+
+    // OT Sender: load the public key received in an earlier session
+    bool load_public_key(Cryptosystem* pkc, seal::PublicKey& public_key,
+            emp::block& key_id);
+    bool save_public_key(Cryptosystem* pkc, const seal::PublicKey& public_key,
+            const emp::block& key_id);
+
+    KeyRotationPolicy policy;
+private:
+    std::string path(Cryptosystem* pkc, int role) const;
+
+    std::string directory;
+    std::string peer;
+};
+#endif //PQ_OT_KEY_STORE_H__
@@ -0,0 +1,223 @@
+#ifndef PQ_OT_LOCKFREE_QUEUE_H__
+#define PQ_OT_LOCKFREE_QUEUE_H__
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+#include <memory>
+#include <emmintrin.h>
+
+// Checks of the waited-for condition before a waiting thread starts yielding,
+// and then before it parks
+#define QUEUE_SPIN_ITERATIONS 512
+#define QUEUE_YIELD_ITERATIONS 64
+
+// Blocks a thread until a condition holds. The thread spins first, then
+// yields, and only parks on the condition variable if the wait drags on, so
+// that short waits take no system call on either side. Threads that make the
+// condition true call notify, which only takes the lock if a thread is parked.
+class Parker {
+public:
+    template <typename Ready>
+    void wait(Ready ready) {
+        for(int i = 0; i < QUEUE_SPIN_ITERATIONS; i++) {
+            if (ready()) return;
+            _mm_pause();
+        }
+        for(int i = 0; i < QUEUE_YIELD_ITERATIONS; i++) {
+            if (ready()) return;
+            std::this_thread::yield();
+        }
+        std::unique_lock<std::mutex> lock(mutex_);
+        parked_.fetch_add(1);
+        // Pairs with the fence in notify: either notify sees the parked
+        // thread, or the thread sees the state that notify published
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        while (!ready()) {
+            cond_.wait(lock);
+        }
+        parked_.fetch_sub(1);
+    }
+
+    void notify() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (parked_.load(std::memory_order_relaxed) == 0) return;
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.notify_all();
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cond_;
+    std::atomic<int> parked_{0};
+};
+
+// Bounded multi-producer single-consumer ring buffer, after Dmitry Vyukov's
+// bounded MPMC queue. Every cell carries a sequence number saying whether it
+// is free for the producer at that position or holds an item for the
+// consumer, so that a push takes a single CAS on the tail and a pop none.
+// Producers wait while the ring is full, and the consumer while it is empty.
+template <typename T>
+class MPSCQueue {
+public:
+    explicit MPSCQueue(size_t capacity = 1024) {
+        size_t size = 1;
+        while (size < capacity) size <<= 1;
+        cells_.reset(new Cell[size]);
+        mask_ = size - 1;
+        for(size_t i = 0; i < size; i++) {
+            cells_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    MPSCQueue(const MPSCQueue&) = delete;
+    MPSCQueue& operator=(const MPSCQueue&) = delete;
+
+    void push(T item) {
+        Cell* cell;
+        uint64_t pos;
+        if (!try_reserve(cell, pos)) {
+            auto start = std::chrono::steady_clock::now();
+            not_full_.wait([&]() { return try_reserve(cell, pos); });
+            wait_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(
+                    std::chrono::steady_clock::now() - start).count();
+        }
+        cell->item = std::move(item);
+        cell->seq.store(pos + 1, std::memory_order_release);
+        not_empty_.notify();
+    }
+
+    // Must only be called by the consumer thread
+    T pop() {
+        Cell& cell = cells_[head_ & mask_];
+        not_empty_.wait([&]() {
+            return cell.seq.load(std::memory_order_acquire) == head_ + 1;
+        });
+        T item = std::move(cell.item);
+        // Free the cell for the producer one lap ahead
+        cell.seq.store(head_ + mask_ + 1, std::memory_order_release);
+        head_++;
+        not_full_.notify();
+        return item;
+    }
+
+    // Time producers spent waiting for a free cell, in nanoseconds
+    uint64_t wait_time() const {
+        return wait_ns_;
+    }
+
+private:
+    struct Cell {
+        std::atomic<uint64_t> seq;
+        T item;
+    };
+
+    bool try_reserve(Cell*& cell, uint64_t& pos) {
+        pos = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            cell = &cells_[pos & mask_];
+            uint64_t seq = cell->seq.load(std::memory_order_acquire);
+            int64_t diff = (int64_t) seq - (int64_t) pos;
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    return true;
+                }
+            } else if (diff < 0) {
+                // The consumer has not freed the cell from the previous lap
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    std::unique_ptr<Cell[]> cells_;
+    uint64_t mask_;
+    // Keep the producers' tail and the consumer's head on separate cache lines
+    char pad0_[64];
+    std::atomic<uint64_t> tail_{0};
+    char pad1_[64];
+    uint64_t head_ = 0;
+    char pad2_[64];
+    Parker not_empty_;
+    Parker not_full_;
+    std::atomic<uint64_t> wait_ns_{0};
+};
+
+// Single-producer single-consumer queue made of bounded segments. The
+// producer links a new segment when the last one is full instead of waiting
+// for the consumer, so a push never blocks, and the consumer frees segments
+// once it has drained them. Items are published with a release store of the
+// segment's write count, so neither side takes a lock.
+template <typename T>
+class SPSCQueue {
+public:
+    SPSCQueue() {
+        head_ = tail_ = new Segment();
+    }
+
+    ~SPSCQueue() {
+        while (head_ != nullptr) {
+            Segment* next = head_->next.load(std::memory_order_relaxed);
+            delete head_;
+            head_ = next;
+        }
+    }
+
+    SPSCQueue(const SPSCQueue&) = delete;
+    SPSCQueue& operator=(const SPSCQueue&) = delete;
+
+    // Must only be called by the producer thread
+    void push(T item) {
+        uint32_t written = tail_->written.load(std::memory_order_relaxed);
+        if (written == SEGMENT_SIZE) {
+            Segment* segment = new Segment();
+            tail_->next.store(segment, std::memory_order_release);
+            tail_ = segment;
+            written = 0;
+        }
+        tail_->items[written] = std::move(item);
+        tail_->written.store(written + 1, std::memory_order_release);
+        not_empty_.notify();
+    }
+
+    // Must only be called by the consumer thread. Returns false if the queue
+    // is empty.
+    bool try_pop(T& item) {
+        if (head_->read == SEGMENT_SIZE) {
+            Segment* next = head_->next.load(std::memory_order_acquire);
+            if (next == nullptr) return false;
+            delete head_;
+            head_ = next;
+        }
+        if (head_->read == head_->written.load(std::memory_order_acquire)) return false;
+        item = std::move(head_->items[head_->read++]);
+        return true;
+    }
+
+    T pop() {
+        T item;
+        not_empty_.wait([&]() { return try_pop(item); });
+        return item;
+    }
+
+private:
+    static const uint32_t SEGMENT_SIZE = 64;
+
+    struct Segment {
+        T items[SEGMENT_SIZE];
+        std::atomic<uint32_t> written{0};
+        std::atomic<Segment*> next{nullptr};
+        // Only used by the consumer
+        uint32_t read = 0;
+    };
+
+    // Only used by the consumer
+    Segment* head_;
+    char pad_[64];
+    // Only used by the producer
+    Segment* tail_;
+    Parker not_empty_;
+};
+#endif //PQ_OT_LOCKFREE_QUEUE_H__
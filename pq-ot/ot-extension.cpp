@@ -0,0 +1,154 @@
+#include "pq-ot/ot-extension.h"
+
+using namespace std;
+using namespace emp;
+
+// Correlation robust hash H(id, q) = AES256(q, id || 0) || AES256(q, id || 1)
+static inline Label hash_label(const Label& q, uint64_t id) {
+    AESNI_KEY key;
+    AESNI_set_encrypt_key(&key, (unsigned char*) &q, 32);
+    block ct[2];
+    ct[0] = makeBlock(id, 0);
+    ct[1] = makeBlock(id, 1);
+    AESNI_ecb_encrypt_blks(ct, 2, &key);
+    return Label(ct[0], ct[1]);
+}
+
+static inline void xor_label(Label& res, const Label& a, const Label& b) {
+    res.lo = xorBlocks(a.lo, b.lo);
+    res.hi = xorBlocks(a.hi, b.hi);
+}
+
+// Run OTE_KAPPA base OTs with PQOT to seed the PRGs of the extension
+void PQOTExtension::setup() {
+    base_ot->keygen();
+
+    PRG prg;
+    Label seed_0[OTE_KAPPA], seed_1[OTE_KAPPA];
+
+    if (role == ALICE) {
+        // OT Sender samples s and receives k_{s_i} for every base OT
+        bool s_bits[OTE_KAPPA];
+        prg.random_bool(s_bits, OTE_KAPPA);
+        uint8_t* s_bytes = (uint8_t*) &s;
+        memset(s_bytes, 0, sizeof(Label));
+        for(int i = 0; i < OTE_KAPPA; i++) {
+            s_bytes[i / 8] |= s_bits[i] << (i % 8);
+        }
+        base_ot->recv_ot(seed_0, s_bits, OTE_KAPPA);
+        for(int i = 0; i < OTE_KAPPA; i++) {
+            G[i].reseed(seed_0 + i, 32);
+        }
+    } else {
+        // OT Receiver samples the seed pairs (k_0, k_1) and sends them
+        prg.random_label(seed_0, OTE_KAPPA);
+        prg.random_label(seed_1, OTE_KAPPA);
+        base_ot->send_ot(seed_0, seed_1, OTE_KAPPA);
+        for(int i = 0; i < OTE_KAPPA; i++) {
+            G[i].reseed(seed_0 + i, 32);
+            G_1[i].reseed(seed_1 + i, 32);
+        }
+    }
+
+    is_setup = true;
+}
+
+void PQOTExtension::send_ot(const Label* m_0, const Label* m_1, int num_ot) {
+    if (!is_setup) setup();
+    for(int i = 0; i < num_ot; i += OTE_BATCH_SIZE) {
+        send_ot_batch(m_0 + i, m_1 + i, min(OTE_BATCH_SIZE, num_ot - i));
+    }
+    io->flush();
+}
+
+void PQOTExtension::recv_ot(Label* m_b, const bool* b, int num_ot) {
+    if (!is_setup) setup();
+    for(int i = 0; i < num_ot; i += OTE_BATCH_SIZE) {
+        recv_ot_batch(m_b + i, b + i, min(OTE_BATCH_SIZE, num_ot - i));
+    }
+}
+
+void PQOTExtension::send_ot_batch(const Label* m_0, const Label* m_1, int num_ot) {
+    // Columns of the OTE_KAPPA x num_ot bit matrices are padded to whole blocks
+    int num_cols = ((num_ot + 127) / 128) * 128;
+    int col_bytes = num_cols / 8;
+    uint8_t* s_bytes = (uint8_t*) &s;
+
+    block* u = new block[OTE_KAPPA * col_bytes / 16];
+    block* q = new block[OTE_KAPPA * col_bytes / 16];
+    io->recv_data(u, OTE_KAPPA * col_bytes, true);
+
+    // q_i = G(k_{s_i}) ^ s_i * u_i = t_i ^ s_i * r
+    for(int i = 0; i < OTE_KAPPA; i++) {
+        block* q_i = q + i * (col_bytes / 16);
+        G[i].random_block(q_i, col_bytes / 16);
+        if ((s_bytes[i / 8] >> (i % 8)) & 1) {
+            xorBlocks_arr(q_i, q_i, u + i * (col_bytes / 16), col_bytes / 16);
+        }
+    }
+
+    // Row j of the transposed matrix is q_j = t_j ^ r_j * s
+    Label* q_rows = new Label[num_cols];
+    sse_trans((uint8_t*) q_rows, (uint8_t*) q, OTE_KAPPA, num_cols);
+
+    // y_0 = m_0 ^ H(j, q_j), y_1 = m_1 ^ H(j, q_j ^ s)
+    Label* y = new Label[2 * num_ot];
+    Label q_s;
+    for(int j = 0; j < num_ot; j++) {
+        xor_label(y[2*j], m_0[j], hash_label(q_rows[j], ot_counter + j));
+        xor_label(q_s, q_rows[j], s);
+        xor_label(y[2*j + 1], m_1[j], hash_label(q_s, ot_counter + j));
+    }
+    io->send_data(y, 2 * num_ot * sizeof(Label), true);
+    ot_counter += num_ot;
+
+    delete[] u;
+    delete[] q;
+    delete[] q_rows;
+    delete[] y;
+}
+
+void PQOTExtension::recv_ot_batch(Label* m_b, const bool* b, int num_ot) {
+    // Columns of the OTE_KAPPA x num_ot bit matrices are padded to whole blocks
+    int num_cols = ((num_ot + 127) / 128) * 128;
+    int col_bytes = num_cols / 8;
+
+    // Choice bits packed into a single column r
+    block* r = new block[col_bytes / 16];
+    uint8_t* r_bytes = (uint8_t*) r;
+    memset(r_bytes, 0, col_bytes);
+    for(int j = 0; j < num_ot; j++) {
+        r_bytes[j / 8] |= b[j] << (j % 8);
+    }
+
+    // u_i = G(k_0) ^ G(k_1) ^ r
+    block* t = new block[OTE_KAPPA * col_bytes / 16];
+    block* u = new block[OTE_KAPPA * col_bytes / 16];
+    for(int i = 0; i < OTE_KAPPA; i++) {
+        block* t_i = t + i * (col_bytes / 16);
+        block* u_i = u + i * (col_bytes / 16);
+        G[i].random_block(t_i, col_bytes / 16);
+        G_1[i].random_block(u_i, col_bytes / 16);
+        xorBlocks_arr(u_i, u_i, t_i, col_bytes / 16);
+        xorBlocks_arr(u_i, u_i, r, col_bytes / 16);
+    }
+    io->send_data(u, OTE_KAPPA * col_bytes, true);
+
+    // Row j of the transposed matrix is t_j
+    Label* t_rows = new Label[num_cols];
+    sse_trans((uint8_t*) t_rows, (uint8_t*) t, OTE_KAPPA, num_cols);
+
+    // m_b = y_b ^ H(j, t_j)
+    Label* y = new Label[2 * num_ot];
+    io->recv_data(y, 2 * num_ot * sizeof(Label), true);
+    for(int j = 0; j < num_ot; j++) {
+        xor_label(m_b[j], y[2*j + b[j]], hash_label(t_rows[j], ot_counter + j));
+    }
+    ot_counter += num_ot;
+
+    delete[] r;
+    delete[] t;
+    delete[] u;
+    delete[] t_rows;
+    delete[] y;
+}
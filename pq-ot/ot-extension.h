@@ -0,0 +1,52 @@
+#ifndef PQ_OT_EXTENSION_H__
+#define PQ_OT_EXTENSION_H__
+#include "pq-ot/pq-ot.h"
+
+// Number of base OTs (and bitlength of the correlation) used by the extension
+#define OTE_KAPPA LABEL_BITLEN
+// Number of OTs extended in one round to bound the memory footprint
+#define OTE_BATCH_SIZE (1 << 16)
+
+// IKNP-style OT extension over 256-bit labels. OTE_KAPPA base OTs are run
+// once with PQOT in the reverse direction, after which every extended OT only
+// costs AES-256 operations and 3 labels of communication.
+class PQOTExtension {
+public:
+    PQOTExtension(emp::IOChannel* io, int role, int num_threads = 1) {
+        assert(role == emp::ALICE || role == emp::BOB);
+        this->role = role;
+        this->io = io;
+        // The OT Sender of the extension is the OT Receiver of the base OTs
+        base_ot = new PQOT(io, 3 - role, num_threads);
+    }
+
+    ~PQOTExtension() {
+        delete base_ot;
+    }
+
+    // Reuse the keys of the base OTs from store, see PQOT::set_key_store
+    void set_key_store(KeyStore* store) {
+        base_ot->set_key_store(store);
+    }
+
+    void setup();
+    void send_ot(const emp::Label* m_0, const emp::Label* m_1, int num_ot);
+    void recv_ot(emp::Label* m_b, const bool* b, int num_ot);
+
+    int role;
+private:
+    void send_ot_batch(const emp::Label* m_0, const emp::Label* m_1, int num_ot);
+    void recv_ot_batch(emp::Label* m_b, const bool* b, int num_ot);
+
+    emp::IOChannel* io;
+    PQOT* base_ot;
+    bool is_setup = false;
+    // Index of the next extended OT, used to tweak the hash function
+    uint64_t ot_counter = 0;
+    // OT Sender: s and the PRGs seeded with k_{s_i}
+    emp::Label s;
+    emp::PRG G[OTE_KAPPA];
+    // OT Receiver: PRGs seeded with k_1 (k_0 uses G)
+    emp::PRG G_1[OTE_KAPPA];
+};
+#endif //PQ_OT_EXTENSION_H__
@@ -27,134 +27,220 @@ void load(mpz_t *output, int length, istream& stream){
     return;
 }
 
-// OT Receiver generates a key pair and sends the public key to OT Sender
-void PQOT::keygen(){
-    // Start the IO threads for key exchange
-    switch (role) {
-        case 1:
-            recv->start();
-            break;
-        case 2:
-            send->start();
-            break;
+// Utility functions to convert between integers and little-endian byte strings
+static void mpz_to_bytes(uint8_t* output, int length, const mpz_t input){
+    memset(output, 0, length);
+    mpz_export(output, NULL, -1, 1, 0, 0, input);
+}
+
+static void bytes_to_mpz(mpz_t output, int length, const uint8_t* input){
+    mpz_import(output, length, -1, 1, 0, 0, input);
+}
+
+Cryptosystem* PQOT::get_cryptosystem(int param_set){
+    if (pkc[param_set] == nullptr) {
+        pkc[param_set] = new Cryptosystem(role, pqot_params[param_set].plain_modulus_bitlen,
+                pqot_params[param_set].poly_degree, num_threads);
     }
+    return pkc[param_set];
+}
 
-    SetupWorkerThread* setup_worker;
-    // Use channel 0 for the exchange
-    setup_worker = new SetupWorkerThread(role, 0, pkc, send, recv);
-    setup_worker->start();
-    setup_worker->wait();
+int PQOT::param_set(int num_ot, int bitlen) const{
+    if (plain_modulus_bitlen != PQOT_AUTO_PARAMS) return default_param_set;
+    // Both parties track the same keys, so they select the same parameters
+    return select_param_set(num_ot, bitlen, num_threads, has_keys);
+}
 
-    // Stop the IO threads
-    switch (role) {
-        case 1:
-            recv->wait();
-            break;
-        case 2:
-            send->signal_end();
-            send->wait();
+void PQOT::begin_call(PQOTCall& call, int num_ot, int bitlen){
+    unique_lock<mutex> lock(call_mutex);
+    call.slot = call_seq++ % num_slots;
+    // Parameters are selected in call order, so both parties agree on them
+    if (call.param_set == PQOT_SELECT_PARAMS) {
+        call.param_set = param_set(num_ot, bitlen);
+    }
+    if (call.param_set != PQOT_NO_PARAMS) {
+        call.exchange_keys = !has_keys[call.param_set];
+        has_keys[call.param_set] = true;
     }
+    // Wait for the previous call on the same channels
+    while (slot_busy[call.slot]) {
+        call_cond.wait(lock);
+    }
+    slot_busy[call.slot] = true;
+    call.channel = call.slot * num_threads;
+    call.num_channels = num_threads;
+    // Flush buffered data first, so that the IO threads never flush the stream
+    if (calls_in_flight++ == 0) {
+        for(emp::IOChannel* stripe : ios) stripe->flush();
+    }
+    if (call.recv_io) recv->arm();
 }
 
-void PQOT::send_ot(mpz_t* m_0, mpz_t* m_1, int num_ot, int bitlen, bool verify_ot){
-    // Start the IO threads
-    send->start();
-    recv->start();
+Cryptosystem* PQOT::prepare_keys(PQOTCall& call){
+    if (call.exchange_keys) {
+        // Use the first channel of the call for the exchange
+        SetupJob setup_job(role, call.channel, get_cryptosystem(call.param_set), send, recv);
+        setup_job.set_key_store(key_store);
+        setup_job.run();
+        unique_lock<mutex> lock(call_mutex);
+        keys_ready[call.param_set] = true;
+        call_cond.notify_all();
+    } else {
+        unique_lock<mutex> lock(call_mutex);
+        while (!keys_ready[call.param_set]) {
+            call_cond.wait(lock);
+        }
+    }
+    return pkc[call.param_set];
+}
+
+void PQOT::end_call(PQOTCall& call){
+    if (call.send_io) send->signal_end();
+    unique_lock<mutex> lock(call_mutex);
+    slot_busy[call.slot] = false;
+    call_cond.notify_all();
+    if (--calls_in_flight == 0) {
+        lock.unlock();
+        // The IO threads must be done with io before it is used directly
+        send->wait_idle();
+        recv->wait_idle();
+    }
+}
 
-    int id = 0, count = 0;
-    vector<int> ot_per_thread(num_threads);
+// OT Receiver generates a key pair and sends the public key to OT Sender
+void PQOT::keygen(){
+    // Only OT Receiver sends during the key exchange, unless the parties
+    // compare their stored keys first
+    PQOTCall call;
+    call.send_io = (role == emp::BOB) || (key_store != nullptr);
+    call.recv_io = (role == emp::ALICE) || (key_store != nullptr);
+    call.param_set = default_param_set;
+    begin_call(call);
+    prepare_keys(call);
+    end_call(call);
+}
+
+void PQOT::ciphertext_layout(Cryptosystem* pkc, int num_ot, int bitlen,
+        int& num_cts, int& msgs_per_ctxt) const{
     int slot_bitlen = pkc->plain_modulus_bitlen - 1;
     int slots_per_msg = ceil((double) bitlen/slot_bitlen);
-    int msgs_per_ctxt = floor((double) pkc->poly_degree/slots_per_msg);
-    // Divide num_ot among threads
-    divide_iterations(ot_per_thread, num_ot, num_threads, msgs_per_ctxt);
-    vector<SenderWorkerThread*> sender_workers(num_threads);
-    for(int i = 0; i < num_threads; i++) {
-        if(ot_per_thread[i] > 0) {
-            // Intialize the OT Sender thread
-            sender_workers[i] = new SenderWorkerThread(i, bitlen, pkc, send, recv);
-            // Set the range of OT indices it is supposed to compute
-            sender_workers[i]->set_iteration_bounds(id, id + ot_per_thread[i]);
-            sender_workers[i]->set_input(m_0, m_1);
-            id += ot_per_thread[i];
-            // Start the OT Sender thread
-            sender_workers[i]->start();
-            count++;
-        }
+    msgs_per_ctxt = floor((double) pkc->poly_degree/slots_per_msg);
+    assert(msgs_per_ctxt > 0);
+    num_cts = ceil((double) num_ot/msgs_per_ctxt);
+}
+
+void PQOT::send_ot(const uint8_t* m_0, const uint8_t* m_1, int num_ot, int bitlen){
+    PQOTCall call;
+    call.send_io = true;
+    call.recv_io = true;
+    call.param_set = PQOT_SELECT_PARAMS;
+    begin_call(call, num_ot, bitlen);
+
+    Cryptosystem* pkc = prepare_keys(call);
+    int num_cts, msgs_per_ctxt;
+    ciphertext_layout(pkc, num_ot, bitlen, num_cts, msgs_per_ctxt);
+    vector<SenderJob*> sender_jobs(num_cts);
+    for(int h = 0; h < num_cts; h++) {
+        // Receive cb (encryption of choice bit) from OT Receiver. Ciphertexts
+        // may arrive in any order, and are handed to the pool as they are taken
+        Buffer cb = recv->get_task(call.channel_of(h), call.seq_of(h));
+        sender_jobs[h] = new SenderJob(call.channel_of(h), call.seq_of(h), bitlen, pkc, send);
+        sender_jobs[h]->set_iteration_bounds(h * msgs_per_ctxt, min(num_ot, (h + 1) * msgs_per_ctxt));
+        sender_jobs[h]->set_input(m_0, m_1, std::move(cb));
+        pool->submit(sender_jobs[h]);
     }
 
-    for(int i = 0; i < count; i++) {
-        sender_workers[i]->wait();
+    for(int h = 0; h < num_cts; h++) {
+        sender_jobs[h]->wait();
+        delete sender_jobs[h];
     }
 
-    // Stop the IO threads
-    send->signal_end();
-    send->wait();
-    recv->wait();
-    // Verify the computed OTs
-    if (verify_ot) verify(m_0, m_1, num_ot);
+    end_call(call);
 }
 
-void PQOT::recv_ot(mpz_t* m_b, bool* b, int num_ot, int bitlen, bool verify_ot){
-    // Start the IO threads
-    send->start();
-    recv->start();
+void PQOT::recv_ot(uint8_t* m_b, const bool* b, int num_ot, int bitlen){
+    PQOTCall call;
+    call.send_io = true;
+    call.recv_io = true;
+    call.param_set = PQOT_SELECT_PARAMS;
+    begin_call(call, num_ot, bitlen);
 
-    int id = 0, count = 0;
-    vector<int> ot_per_thread(num_threads);
-    int slot_bitlen = pkc->plain_modulus_bitlen - 1;
-    int slots_per_msg = ceil((double) bitlen/slot_bitlen);
-    int msgs_per_ctxt = floor((double) pkc->poly_degree/slots_per_msg);
-    // Divide num_ot among threads
-    divide_iterations(ot_per_thread, num_ot, num_threads, msgs_per_ctxt);
-    vector<ReceiverWorkerThread*> receiver_workers(num_threads);
-    for(int i = 0; i < num_threads; i++) {
-        if(ot_per_thread[i] > 0) {
-            // Intialize the OT Receiver thread
-            receiver_workers[i] = new ReceiverWorkerThread(i, bitlen, pkc, send, recv);
-            // Set the range of OT indices it is supposed to compute
-            receiver_workers[i]->set_iteration_bounds(id, id + ot_per_thread[i]);
-            receiver_workers[i]->set_input(b);
-            receiver_workers[i]->set_output(m_b);
-            id += ot_per_thread[i];
-            // Start the OT Receiver thread
-            receiver_workers[i]->start();
-            count++;
-        }
+    Cryptosystem* pkc = prepare_keys(call);
+    int num_cts, msgs_per_ctxt;
+    ciphertext_layout(pkc, num_ot, bitlen, num_cts, msgs_per_ctxt);
+    vector<ReceiverJob*> receiver_jobs(num_cts);
+    vector<DecryptJob*> decrypt_jobs(num_cts);
+    for(int h = 0; h < num_cts; h++) {
+        // Encrypt the choice bits of ciphertext h
+        receiver_jobs[h] = new ReceiverJob(call.channel_of(h), call.seq_of(h), bitlen, pkc, send);
+        receiver_jobs[h]->set_iteration_bounds(h * msgs_per_ctxt, min(num_ot, (h + 1) * msgs_per_ctxt));
+        receiver_jobs[h]->set_input(b);
+        pool->submit(receiver_jobs[h]);
+    }
+
+    for(int h = 0; h < num_cts; h++) {
+        // Receive cm_b (encryption of message corresponding to choice bit) from
+        // OT Sender, and decrypt it on the pool
+        Buffer cm_b = recv->get_task(call.channel_of(h), call.seq_of(h));
+        decrypt_jobs[h] = new DecryptJob(bitlen, pkc);
+        decrypt_jobs[h]->set_iteration_bounds(h * msgs_per_ctxt, min(num_ot, (h + 1) * msgs_per_ctxt));
+        decrypt_jobs[h]->set_input(std::move(cm_b));
+        decrypt_jobs[h]->set_output(m_b);
+        pool->submit(decrypt_jobs[h]);
     }
 
-    for(int i = 0; i < count; i++) {
-        receiver_workers[i]->wait();
+    for(int h = 0; h < num_cts; h++) {
+        receiver_jobs[h]->wait();
+        delete receiver_jobs[h];
+        decrypt_jobs[h]->wait();
+        delete decrypt_jobs[h];
     }
 
-    // Stop the IO threads
-    send->signal_end();
-    send->wait();
-    recv->wait();
+    end_call(call);
+}
+
+void PQOT::send_ot(mpz_t* m_0, mpz_t* m_1, int num_ot, int bitlen, bool verify_ot){
+    int msg_bytes = (bitlen + 7) / 8;
+    vector<uint8_t> bytes_0((size_t) num_ot * msg_bytes), bytes_1((size_t) num_ot * msg_bytes);
+    for(int i = 0; i < num_ot; i++){
+        mpz_to_bytes(bytes_0.data() + (size_t) i * msg_bytes, msg_bytes, m_0[i]);
+        mpz_to_bytes(bytes_1.data() + (size_t) i * msg_bytes, msg_bytes, m_1[i]);
+    }
+    send_ot(bytes_0.data(), bytes_1.data(), num_ot, bitlen);
+    // Verify the computed OTs
+    if (verify_ot) verify(m_0, m_1, num_ot);
+}
+
+void PQOT::recv_ot(mpz_t* m_b, bool* b, int num_ot, int bitlen, bool verify_ot){
+    int msg_bytes = (bitlen + 7) / 8;
+    vector<uint8_t> bytes_b((size_t) num_ot * msg_bytes);
+    recv_ot(bytes_b.data(), b, num_ot, bitlen);
+    for(int i = 0; i < num_ot; i++){
+        bytes_to_mpz(m_b[i], msg_bytes, bytes_b.data() + (size_t) i * msg_bytes);
+    }
     // Verify the computed OTs
     if (verify_ot) verify(m_b, b, num_ot);
 }
 
 bool PQOT::verify(mpz_t* m_0, mpz_t* m_1, int num_ot){
-    // Start sender IO thread
-    send->start();
-    stringstream ss;
+    PQOTCall call;
+    call.send_io = true;
+    begin_call(call);
+    BufferOutStream ss;
     save(m_0, num_ot, ss);
     save(m_1, num_ot, ss);
 
     // Send the OT Sender messages to OT Receiver
-    string str = ss.str();
-    send->add_task(0, str.size(), str.c_str());
+    send->add_task(call.channel, ss.take());
 
-    // Stop sender IO thread
-    send->signal_end();
-    send->wait();
+    end_call(call);
     return true;
 }
 
 bool PQOT::verify(mpz_t* m_b, bool* b, int num_ot){
-    // Start receiver IO thread
-    recv->start();
+    PQOTCall call;
+    call.recv_io = true;
+    begin_call(call);
 
     bool flag = true;
 
@@ -166,9 +252,8 @@ bool PQOT::verify(mpz_t* m_b, bool* b, int num_ot){
     }
 
     // Receive the OT Sender messages from OT Sender
-    RecvTask task = recv->get_task(0);
-    stringstream ss;
-    ss.write(task.data, task.length);
+    Buffer task = recv->get_task(call.channel);
+    BufferInStream ss(task);
 
     load(m_0, num_ot, ss);
     load(m_1, num_ot, ss);
@@ -186,7 +271,188 @@ bool PQOT::verify(mpz_t* m_b, bool* b, int num_ot){
     delete[] m_0;
     delete[] m_1;
 
-    // Stop receiver IO thread
-    recv->wait();
+    end_call(call);
     return flag;
 }
+
+// Drop the consumed random OTs from the front of the pool
+static void compact_rot_pool(ROTPool& pool) {
+    uint64_t used = pool.head * pool.msg_bytes;
+    if (used == 0) return;
+    if (pool.r_0.size() > 0) {
+        pool.r_0.erase(pool.r_0.begin(), pool.r_0.begin() + used);
+        pool.r_1.erase(pool.r_1.begin(), pool.r_1.begin() + used);
+    }
+    if (pool.r_c.size() > 0) {
+        pool.r_c.erase(pool.r_c.begin(), pool.r_c.begin() + used);
+        pool.c.erase(pool.c.begin(), pool.c.begin() + pool.head);
+    }
+    pool.head = 0;
+}
+
+void PQOT::precompute_rot(int num_ot, int bitlen){
+    // The pool only holds random OTs of a single bitlength
+    assert(rot_available(bitlen) > 0 || rot_pool.size(role) == 0);
+    compact_rot_pool(rot_pool);
+    rot_pool.bitlen = bitlen;
+    rot_pool.msg_bytes = (bitlen + 7) / 8;
+
+    int msg_bytes = rot_pool.msg_bytes;
+    uint8_t top_mask = (bitlen % 8 == 0) ? 0xFF : (1 << (bitlen % 8)) - 1;
+    emp::PRG prg;
+
+    if (role == emp::ALICE) {
+        // OT Sender transfers random messages r_0 and r_1
+        size_t offset = rot_pool.r_0.size();
+        rot_pool.r_0.resize(offset + (size_t) num_ot * msg_bytes);
+        rot_pool.r_1.resize(offset + (size_t) num_ot * msg_bytes);
+        uint8_t* r_0 = rot_pool.r_0.data() + offset;
+        uint8_t* r_1 = rot_pool.r_1.data() + offset;
+        prg.random_data_unaligned(r_0, num_ot * msg_bytes);
+        prg.random_data_unaligned(r_1, num_ot * msg_bytes);
+        for(int i = 0; i < num_ot; i++){
+            r_0[i * msg_bytes + msg_bytes - 1] &= top_mask;
+            r_1[i * msg_bytes + msg_bytes - 1] &= top_mask;
+        }
+        send_ot(r_0, r_1, num_ot, bitlen);
+    } else {
+        // OT Receiver uses random choice bits c
+        bool* c = new bool[num_ot];
+        prg.random_bool(c, num_ot);
+        size_t offset = rot_pool.r_c.size();
+        rot_pool.r_c.resize(offset + (size_t) num_ot * msg_bytes);
+        recv_ot(rot_pool.r_c.data() + offset, c, num_ot, bitlen);
+        rot_pool.c.insert(rot_pool.c.end(), c, c + num_ot);
+        delete[] c;
+    }
+}
+
+void PQOT::send_ot_precomputed(const uint8_t* m_0, const uint8_t* m_1, int num_ot, int bitlen){
+    assert(rot_available(bitlen) >= (uint64_t) num_ot);
+    int msg_bytes = rot_pool.msg_bytes;
+    const uint8_t* r_0 = rot_pool.r_0.data() + rot_pool.head * msg_bytes;
+    const uint8_t* r_1 = rot_pool.r_1.data() + rot_pool.head * msg_bytes;
+
+    // Receive the corrections d = b ^ c from OT Receiver
+    uint8_t* d = new uint8_t[(num_ot + 7) / 8];
+    io->recv_data(d, (num_ot + 7) / 8, true);
+
+    // y_0 = m_0 ^ r_d, y_1 = m_1 ^ r_{1 ^ d}
+    uint8_t* y = new uint8_t[2 * (size_t) num_ot * msg_bytes];
+    for(int i = 0; i < num_ot; i++){
+        bool d_i = (d[i / 8] >> (i % 8)) & 1;
+        uint8_t* y_0 = y + (2 * i) * msg_bytes;
+        uint8_t* y_1 = y + (2 * i + 1) * msg_bytes;
+        const uint8_t* r_d = (d_i ? r_1 : r_0) + i * msg_bytes;
+        const uint8_t* r_nd = (d_i ? r_0 : r_1) + i * msg_bytes;
+        const uint8_t* m_0_i = m_0 + (size_t) i * msg_bytes;
+        const uint8_t* m_1_i = m_1 + (size_t) i * msg_bytes;
+        for(int j = 0; j < msg_bytes; j++){
+            y_0[j] = m_0_i[j] ^ r_d[j];
+            y_1[j] = m_1_i[j] ^ r_nd[j];
+        }
+    }
+    io->send_data(y, 2 * num_ot * msg_bytes, true);
+    io->flush();
+    rot_pool.head += num_ot;
+
+    delete[] d;
+    delete[] y;
+}
+
+void PQOT::recv_ot_precomputed(uint8_t* m_b, const bool* b, int num_ot, int bitlen){
+    assert(rot_available(bitlen) >= (uint64_t) num_ot);
+    int msg_bytes = rot_pool.msg_bytes;
+    const uint8_t* r_c = rot_pool.r_c.data() + rot_pool.head * msg_bytes;
+    const uint8_t* c = rot_pool.c.data() + rot_pool.head;
+
+    // Send the corrections d = b ^ c to OT Sender
+    uint8_t* d = new uint8_t[(num_ot + 7) / 8];
+    memset(d, 0, (num_ot + 7) / 8);
+    for(int i = 0; i < num_ot; i++){
+        d[i / 8] |= (b[i] ^ c[i]) << (i % 8);
+    }
+    io->send_data(d, (num_ot + 7) / 8, true);
+
+    // m_b = y_b ^ r_c
+    uint8_t* y = new uint8_t[2 * (size_t) num_ot * msg_bytes];
+    io->recv_data(y, 2 * num_ot * msg_bytes, true);
+    for(int i = 0; i < num_ot; i++){
+        const uint8_t* y_b = y + (2 * i + b[i]) * msg_bytes;
+        uint8_t* m_b_i = m_b + (size_t) i * msg_bytes;
+        for(int j = 0; j < msg_bytes; j++){
+            m_b_i[j] = y_b[j] ^ r_c[i * msg_bytes + j];
+        }
+    }
+    rot_pool.head += num_ot;
+
+    delete[] d;
+    delete[] y;
+}
+
+void PQOT::send_ot_precomputed(mpz_t* m_0, mpz_t* m_1, int num_ot, int bitlen){
+    int msg_bytes = (bitlen + 7) / 8;
+    vector<uint8_t> bytes_0((size_t) num_ot * msg_bytes), bytes_1((size_t) num_ot * msg_bytes);
+    for(int i = 0; i < num_ot; i++){
+        mpz_to_bytes(bytes_0.data() + (size_t) i * msg_bytes, msg_bytes, m_0[i]);
+        mpz_to_bytes(bytes_1.data() + (size_t) i * msg_bytes, msg_bytes, m_1[i]);
+    }
+    send_ot_precomputed(bytes_0.data(), bytes_1.data(), num_ot, bitlen);
+}
+
+void PQOT::recv_ot_precomputed(mpz_t* m_b, bool* b, int num_ot, int bitlen){
+    int msg_bytes = (bitlen + 7) / 8;
+    vector<uint8_t> bytes_b((size_t) num_ot * msg_bytes);
+    recv_ot_precomputed(bytes_b.data(), b, num_ot, bitlen);
+    for(int i = 0; i < num_ot; i++){
+        bytes_to_mpz(m_b[i], msg_bytes, bytes_b.data() + (size_t) i * msg_bytes);
+    }
+}
+
+uint64_t PQOT::rot_available(int bitlen) const{
+    if (rot_pool.bitlen != bitlen) return 0;
+    return rot_pool.size(role);
+}
+
+void PQOT::save_rot_pool(const char* filename){
+    compact_rot_pool(rot_pool);
+    ofstream file(filename, ios::out | ios::binary);
+    assert(file.is_open());
+    uint64_t size = rot_pool.size(role);
+    file.write((char*) &role, sizeof(int));
+    file.write((char*) &rot_pool.bitlen, sizeof(int));
+    file.write((char*) &size, sizeof(uint64_t));
+    if (role == emp::ALICE) {
+        file.write((char*) rot_pool.r_0.data(), rot_pool.r_0.size());
+        file.write((char*) rot_pool.r_1.data(), rot_pool.r_1.size());
+    } else {
+        file.write((char*) rot_pool.r_c.data(), rot_pool.r_c.size());
+        file.write((char*) rot_pool.c.data(), rot_pool.c.size());
+    }
+    file.close();
+}
+
+void PQOT::load_rot_pool(const char* filename){
+    ifstream file(filename, ios::in | ios::binary);
+    assert(file.is_open());
+    int file_role;
+    uint64_t size;
+    file.read((char*) &file_role, sizeof(int));
+    file.read((char*) &rot_pool.bitlen, sizeof(int));
+    file.read((char*) &size, sizeof(uint64_t));
+    assert(file_role == role);
+    rot_pool.msg_bytes = (rot_pool.bitlen + 7) / 8;
+    rot_pool.head = 0;
+    if (role == emp::ALICE) {
+        rot_pool.r_0.resize(size * rot_pool.msg_bytes);
+        rot_pool.r_1.resize(size * rot_pool.msg_bytes);
+        file.read((char*) rot_pool.r_0.data(), rot_pool.r_0.size());
+        file.read((char*) rot_pool.r_1.data(), rot_pool.r_1.size());
+    } else {
+        rot_pool.r_c.resize(size * rot_pool.msg_bytes);
+        rot_pool.c.resize(size);
+        file.read((char*) rot_pool.r_c.data(), rot_pool.r_c.size());
+        file.read((char*) rot_pool.c.data(), rot_pool.c.size());
+    }
+    file.close();
+}
@@ -4,52 +4,214 @@
 #include <cassert>
 #include <fstream>
 #include "pq-ot/pq-otmain.h"
+#include "pq-ot/key-store.h"
+
+// Random OTs computed in the offline phase. OT Sender holds the random
+// messages (r_0, r_1), OT Receiver holds the random choice bits c and r_c.
+// Each message takes msg_bytes bytes in little-endian order.
+struct ROTPool {
+    int bitlen = 0;
+    int msg_bytes = 0;
+    // Index of the next unused random OT
+    uint64_t head = 0;
+    std::vector<uint8_t> r_0, r_1;
+    std::vector<uint8_t> r_c, c;
+
+    uint64_t size(int role) const {
+        if (msg_bytes == 0) return 0;
+        return (role == emp::ALICE ? r_0.size() : r_c.size()) / msg_bytes - head;
+    }
+};
+
+// Select the HE parameters of every call with the cost model in pq-otmain.h
+#define PQOT_AUTO_PARAMS 0
+// Maximum number of calls in flight on one PQOT instance
+#define PQOT_MAX_CALLS 4
+
+// Values of PQOTCall::param_set other than a PQOTParamSet
+#define PQOT_NO_PARAMS -1
+#define PQOT_SELECT_PARAMS -2
+
+// A call to PQOT. Calls are numbered in the order in which they start, which
+// must be the same on both parties, and call seq uses the block of
+// num_threads channels starting at (seq % num_slots) * num_threads.
+// Ciphertext h of a call is sent as message seq_of(h) on channel channel_of(h),
+// so that ciphertexts can be computed by any thread in any order.
+struct PQOTCall {
+    bool send_io = false;
+    bool recv_io = false;
+    // Parameter set whose keys the call needs
+    int param_set = PQOT_NO_PARAMS;
+    // Set if this call runs the key exchange for param_set
+    bool exchange_keys = false;
+    int slot = 0;
+    int channel = 0;
+    int num_channels = 1;
+
+    int channel_of(int h) const {
+        return channel + h % num_channels;
+    }
+
+    uint32_t seq_of(int h) const {
+        return h / num_channels;
+    }
+};
 
 class PQOT{
 public:
-    PQOT(emp::NetIO* io, int role, int num_threads = 1, int plain_modulus_bitlen = 17){
+    PQOT(emp::IOChannel* io, int role, int num_threads = 1, int plain_modulus_bitlen = PQOT_AUTO_PARAMS)
+        : PQOT(std::vector<emp::IOChannel*>{io}, role, num_threads, plain_modulus_bitlen) {}
+
+    // Stripe the channels of the instance across several connections to the
+    // same party, opened in the same order on both sides. ios[0] also carries
+    // the messages that PQOT exchanges outside of the IO threads.
+    PQOT(const std::vector<emp::IOChannel*>& ios, int role, int num_threads = 1,
+            int plain_modulus_bitlen = PQOT_AUTO_PARAMS){
+        assert(!ios.empty());
         assert(role == 1 || role == 2);
         // HE Parameters configured only for the following two choices
-        assert(plain_modulus_bitlen == 17 || plain_modulus_bitlen == 33);
+        assert(plain_modulus_bitlen == PQOT_AUTO_PARAMS
+                || plain_modulus_bitlen == 17 || plain_modulus_bitlen == 33);
 
         this->role = role;
         this->plain_modulus_bitlen = plain_modulus_bitlen;
 
-        int poly_degree;
-        if (plain_modulus_bitlen == 17) poly_degree = 8192;
-        else poly_degree = 16384; // plain_modulus_bitlen == 33
-
-        // Setup the parameters and the context required by the HE scheme
-        pkc = new Cryptosystem(this->role, plain_modulus_bitlen, poly_degree);
+        if (plain_modulus_bitlen == 17) default_param_set = PARAMS_8192_17;
+        else if (plain_modulus_bitlen == 33) default_param_set = PARAMS_16384_33;
+        else default_param_set = PARAMS_4096_17; // PQOT_AUTO_PARAMS
 
+        assert(num_threads > 0 && num_threads < ADMIN_CHANNEL);
         this->num_threads = num_threads;
-        this->io = io;
-        // Dedicated sender IO thread
-        this->send = new SendThread(io);
-        // Dedicated receiver IO thread
-        this->recv = new RecvThread(io, num_threads);
+
+        // Setup the parameters and the context required by the HE scheme.
+        // Contexts of the other parameter sets are created on first use.
+        for(int i = 0; i < NUM_PARAM_SETS; i++) {
+            pkc[i] = nullptr;
+            has_keys[i] = false;
+            keys_ready[i] = false;
+        }
+        get_cryptosystem(default_param_set);
+
+        this->ios = ios;
+        this->io = ios[0];
+        // Calls in flight get disjoint blocks of channels
+        num_slots = std::max(1, std::min(PQOT_MAX_CALLS, ADMIN_CHANNEL / num_threads));
+        slot_busy.resize(num_slots, false);
+        // Worker threads and IO threads live as long as the instance, and
+        // every call submits a job per ciphertext to them
+        pool = new WorkerPool(num_threads);
+        // Dedicated sender and receiver IO threads for every connection
+        this->send = new StripedSend(ios);
+        this->recv = new StripedRecv(ios, num_slots * num_threads);
     }
 
     ~PQOT() {
-        // Stop the IO threads
-        send->signal_end();
-        send->wait();
-        recv->wait();
+        // Stop the worker threads and the IO threads
+        delete pool;
+        delete send;
+        delete recv;
+        for(int i = 0; i < NUM_PARAM_SETS; i++) {
+            delete pkc[i];
+        }
+    }
+
+    // Reuse keys from store in this and later sessions with the same peer.
+    // Both parties must set a key store before the first key exchange.
+    void set_key_store(KeyStore* store) {
+        key_store = store;
     }
 
     void keygen();
+
+    // OTs on num_ot bitlen-bit messages stored back to back in byte arrays,
+    // (bitlen + 7) / 8 bytes per message in little-endian order. Bits above
+    // bitlen must be zero.
+    void send_ot(const uint8_t* m_0, const uint8_t* m_1, int num_ot, int bitlen);
+    void recv_ot(uint8_t* m_b, const bool* b, int num_ot, int bitlen);
+
+    // OTs on labels
+    void send_ot(const emp::Label* m_0, const emp::Label* m_1, int num_ot) {
+        send_ot((const uint8_t*) m_0, (const uint8_t*) m_1, num_ot, LABEL_BITLEN);
+    }
+    void recv_ot(emp::Label* m_b, const bool* b, int num_ot) {
+        recv_ot((uint8_t*) m_b, b, num_ot, LABEL_BITLEN);
+    }
+
+    // OTs on GMP integers, converted to and from byte arrays
     void send_ot(mpz_t* m_0, mpz_t* m_1, int num_ot, int bitlen, bool verify_ot = false);
     void recv_ot(mpz_t* m_b, bool* b, int num_ot, int bitlen, bool verify_ot = false);
     bool verify(mpz_t* m_0, mpz_t* m_1, int num_ot);
     bool verify(mpz_t* m_b, bool* b, int num_ot);
 
+    // Offline phase: precompute num_ot random OTs on bitlen-bit messages
+    void precompute_rot(int num_ot, int bitlen);
+    // Online phase: derandomize precomputed random OTs, which takes no HE
+    // operations and a single round trip
+    void send_ot_precomputed(const uint8_t* m_0, const uint8_t* m_1, int num_ot, int bitlen);
+    void recv_ot_precomputed(uint8_t* m_b, const bool* b, int num_ot, int bitlen);
+    void send_ot_precomputed(mpz_t* m_0, mpz_t* m_1, int num_ot, int bitlen);
+    void recv_ot_precomputed(mpz_t* m_b, bool* b, int num_ot, int bitlen);
+    // Number of precomputed random OTs on bitlen-bit messages left in the pool
+    uint64_t rot_available(int bitlen) const;
+    // Spill the unused part of the pool to disk, and load it back
+    void save_rot_pool(const char* filename);
+    void load_rot_pool(const char* filename);
+
+    // Parameter set used for num_ot OTs on bitlen-bit messages
+    int param_set(int num_ot, int bitlen) const;
+
+    // Bytes sent and received on every connection of the instance
+    uint64_t get_total_comm() const {
+        uint64_t total = 0;
+        for(emp::IOChannel* stripe : ios) {
+            total += stripe->get_total_comm();
+        }
+        return total;
+    }
+
+    // Time spent by the threads of the instance waiting for the locks of the
+    // worker pool and for room in the send queues, in microseconds
+    double lock_wait_time() const {
+        return (pool->lock_wait_time() + send->lock_wait_time()) / 1000.0;
+    }
+
     int role;
+    // PQOT_AUTO_PARAMS, or the fixed plaintext modulus bitlength
     int plain_modulus_bitlen;
     int num_threads;
 private:
-    emp::NetIO* io;
-    SendThread* send;
-    RecvThread* recv;
-    Cryptosystem* pkc;
+    Cryptosystem* get_cryptosystem(int param_set);
+    // Number the call, select its parameters, reserve its channels and arm
+    // the IO threads
+    void begin_call(PQOTCall& call, int num_ot = 0, int bitlen = 0);
+    // Number of ciphertexts and OTs per ciphertext for a call
+    void ciphertext_layout(Cryptosystem* pkc, int num_ot, int bitlen,
+            int& num_cts, int& msgs_per_ctxt) const;
+    // Run the key exchange if the call needs it, or wait for the call that
+    // runs it, and return the cryptosystem of the call
+    Cryptosystem* prepare_keys(PQOTCall& call);
+    // Signal the end of the call to the other party, and wait for the IO
+    // threads if no other call is in flight
+    void end_call(PQOTCall& call);
+
+    std::vector<emp::IOChannel*> ios;
+    emp::IOChannel* io;
+    StripedSend* send;
+    StripedRecv* recv;
+    WorkerPool* pool;
+    Cryptosystem* pkc[NUM_PARAM_SETS];
+    // Set once a call has been assigned to exchange the keys
+    bool has_keys[NUM_PARAM_SETS];
+    bool keys_ready[NUM_PARAM_SETS];
+    int default_param_set;
+    KeyStore* key_store = nullptr;
+    ROTPool rot_pool;
+
+    std::mutex call_mutex;
+    std::condition_variable call_cond;
+    uint64_t call_seq = 0;
+    int num_slots;
+    std::vector<bool> slot_busy;
+    int calls_in_flight = 0;
 };
 #endif //RLWE_OT_H__
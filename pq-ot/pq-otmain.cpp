@@ -1,30 +1,83 @@
 #include "pq-ot/pq-otmain.h"
+#include "pq-ot/key-store.h"
 
 using namespace std;
 using namespace seal;
 using namespace seal::util;
 
-// Divides iterations among threads such that each thread gets at most a block
-// of ceil(num_iters/(num_threads*multiplier))*multiplier iterations and all
-// blocks (except one) have iterations in a multiple of multiplier
-void divide_iterations(vector<int> &iters_per_thread, int num_iters,
-        int num_threads, int multiplier) {
-    int num_chunks = floor((double) num_iters / multiplier);
-    int num_chunks_per_thread = floor((double) num_chunks / num_threads);
-    for(int i = 0; i < num_threads; i++) {
-        iters_per_thread[i] = num_chunks_per_thread * multiplier;
+// 17-bit sets use a 100-bit ciphertext modulus (60 + 40 bits) and the 33-bit
+// set a 150-bit one (3 x 50 bits), see Cryptosystem
+const PQOTParams pqot_params[NUM_PARAM_SETS] = {
+    {4096, 17, 2},
+    {8192, 17, 2},
+    {16384, 33, 3}
+};
+
+// Cost of one ciphertext in units of processed RNS coefficients. OT Receiver
+// encrypts and OT Sender multiplies by 2 plaintexts, each taking about log2(n)
+// NTT passes per modulus, and 2 polynomials are sent with num_moduli moduli
+// and returned with 1 modulus after modulus switching.
+static double ciphertext_cost(const PQOTParams& p) {
+    double n = p.poly_degree;
+    return n * (4 * log2(n) * p.num_moduli + 2 * (p.num_moduli + 1));
+}
+
+double estimate_ot_cost(int param_set, int num_ot, int bitlen, int num_threads,
+        bool has_keys) {
+    const PQOTParams& p = pqot_params[param_set];
+    int slot_bitlen = p.plain_modulus_bitlen - 1;
+    int slots_per_msg = ceil((double) bitlen/slot_bitlen);
+    int msgs_per_ctxt = floor((double) p.poly_degree/slots_per_msg);
+    if (msgs_per_ctxt == 0) return INFINITY;
+    // Ciphertexts are spread over the worker threads, so the latency is set
+    // by the thread with the most ciphertexts
+    int num_cts = ceil((double) num_ot / msgs_per_ctxt);
+    int cts_per_thread = ceil((double) num_cts / num_threads);
+    double cost = cts_per_thread * ciphertext_cost(p);
+    // Key exchange costs about as much as a ciphertext
+    if (!has_keys) cost += ciphertext_cost(p);
+    return cost;
+}
+
+int select_param_set(int num_ot, int bitlen, int num_threads, const bool* has_keys) {
+    int best = 0;
+    double best_cost = estimate_ot_cost(0, num_ot, bitlen, num_threads, has_keys[0]);
+    // Ties go to the smaller ring
+    for(int i = 1; i < NUM_PARAM_SETS; i++) {
+        double cost = estimate_ot_cost(i, num_ot, bitlen, num_threads, has_keys[i]);
+        if (cost < best_cost) {
+            best = i;
+            best_cost = cost;
+        }
     }
-    int chunks_left = num_chunks - (num_chunks_per_thread) * num_threads;
-    for(int i = 0; i < chunks_left; i++) { 
-        iters_per_thread[i] += 1 * multiplier;
+    return best;
+}
+
+shared_ptr<SEALContext> get_context(const EncryptionParameters& parms) {
+    if (parms.random_generator() != nullptr
+            && parms.random_generator() != UniformRandomGeneratorFactory::default_factory()) {
+        return SEALContext::Create(parms);
     }
-    iters_per_thread[chunks_left] += (num_iters - num_chunks * multiplier);
+    static mutex contexts_mutex;
+    static map<pair<size_t, uint64_t>, shared_ptr<SEALContext>> contexts;
+    // The coefficient moduli are fixed by the plaintext modulus
+    auto key = make_pair(parms.poly_modulus_degree(), parms.plain_modulus().value());
+    unique_lock<mutex> lock(contexts_mutex);
+    auto it = contexts.find(key);
+    if (it != contexts.end()) {
+        return it->second;
+    }
+    shared_ptr<SEALContext> context = SEALContext::Create(parms);
+    contexts[key] = context;
+    return context;
 }
 
 // Sample a polynomial in ciphertext ring with uniformly random coefficients
-// of bitlen bits
-void sample_poly_coeffs_uniform(uint64_t *poly, uint32_t bitlen,
-        shared_ptr<UniformRandomGenerator> random,
+// of bitlen bits. The coefficients are drawn as one batch of AES-256 CTR
+// blocks from prg, masked to bitlen bits and then reduced modulo every RNS
+// component. Noise of less than 64 bits takes one 64-bit word per coefficient,
+// so that a block covers two coefficients.
+void sample_poly_coeffs_uniform(uint64_t *poly, uint32_t bitlen, emp::PRG &prg,
         shared_ptr<const SEALContext::ContextData> &context_data)
 {
     assert(bitlen < 128 && bitlen > 0);
@@ -32,25 +85,36 @@ void sample_poly_coeffs_uniform(uint64_t *poly, uint32_t bitlen,
     auto &coeff_modulus = parms.coeff_modulus();
     size_t coeff_count = parms.poly_modulus_degree();
     size_t coeff_mod_count = coeff_modulus.size();
-    uint64_t bitlen_mask = (1ULL << (bitlen % 64)) - 1;
+    size_t num_blocks = bitlen < 64 ? (coeff_count + 1) / 2 : coeff_count;
+
+    // Per-thread buffer, so that no allocation is made per polynomial
+    static thread_local vector<uint64_t> buffer;
+    buffer.resize(2 * num_blocks);
+    emp::block* noise = (emp::block*) buffer.data();
+    prg.random_block(noise, num_blocks);
+
+    // Mask of the lower bitlen bits of a word (bitlen < 64), or of a block
+    // (MSB || LSB) otherwise
+    emp::block mask;
+    if (bitlen < 64) mask = emp::makeBlock((1ULL << bitlen) - 1, (1ULL << bitlen) - 1);
+    else if (bitlen == 64) mask = emp::makeBlock(0ULL, ~0ULL);
+    else mask = emp::makeBlock((1ULL << (bitlen - 64)) - 1, ~0ULL);
+    for (size_t i = 0; i < num_blocks; i++) {
+        noise[i] = _mm_and_si128(noise[i], mask);
+    }
 
-    RandomToStandardAdapter engine(random);
-    for (size_t i = 0; i < coeff_count; i++) {
+    // Each block holds the 64-bit words LSB || MSB in memory
+    const uint64_t* words = buffer.data();
+    for (size_t j = 0; j < coeff_mod_count; j++) {
+        uint64_t *poly_j = poly + (j * coeff_count);
+        const SmallModulus &modulus = coeff_modulus[j];
         if (bitlen < 64) {
-            uint64_t noise = (uint64_t(engine()) << 32) | engine();
-            noise &= bitlen_mask;
-            for (size_t j = 0; j < coeff_mod_count; j++) {
-                poly[i + (j * coeff_count)] = noise % coeff_modulus[j].value();
+            for (size_t i = 0; i < coeff_count; i++) {
+                poly_j[i] = barrett_reduce_63(words[i], modulus);
             }
         } else {
-            uint64_t noise[2]; // LSB || MSB
-            for(int j = 0; j < 2; j++){
-                noise[0] = (uint64_t(engine()) << 32) | engine();
-                noise[1] = (uint64_t(engine()) << 32) | engine();
-            }
-            noise[1] &= bitlen_mask;
-            for (size_t j = 0; j < coeff_mod_count; j++) {
-                poly[i + (j * coeff_count)] = barrett_reduce_128(noise, coeff_modulus[j]);
+            for (size_t i = 0; i < coeff_count; i++) {
+                poly_j[i] = barrett_reduce_128(words + 2 * i, modulus);
             }
         }
     }
@@ -67,10 +131,11 @@ void flood_ciphertext(Ciphertext &ct,
     size_t coeff_mod_count = coeff_modulus.size();
 
     auto noise(allocate_poly(coeff_count, coeff_mod_count, pool));
-    shared_ptr<UniformRandomGenerator> random(parms.random_generator()->create());
+    // Every thread draws noise from its own AES-CTR stream
+    static thread_local emp::PRG prg;
 
     // Flood the first coeff of ct
-    sample_poly_coeffs_uniform(noise.get(), noise_len, random, context_data);
+    sample_poly_coeffs_uniform(noise.get(), noise_len, prg, context_data);
     for (size_t i = 0; i < coeff_mod_count; i++) {
         add_poly_poly_coeffmod(noise.get() + (i * coeff_count), 
             ct.data() + (i * coeff_count), coeff_count, 
@@ -78,7 +143,7 @@ void flood_ciphertext(Ciphertext &ct,
     }
 
     // Flood the second coeff of ct
-    sample_poly_coeffs_uniform(noise.get(), noise_len, random, context_data);
+    sample_poly_coeffs_uniform(noise.get(), noise_len, prg, context_data);
     for (size_t i = 0; i < coeff_mod_count; i++) {
         add_poly_poly_coeffmod(noise.get() + (i * coeff_count), 
             ct.data(1) + (i * coeff_count), coeff_count, 
@@ -86,257 +151,317 @@ void flood_ciphertext(Ciphertext &ct,
     }
 }
 
-void SetupWorkerThread::run_sender() {
-    // Receive public key from OT Receiver
-    RecvTask task = recv->get_task(channel_id);
-    stringstream ss;
-    ss.write(task.data, task.length);
-
+void SetupJob::run_sender() {
     PublicKey public_key;
-    public_key.load(pkc->context, ss);
+    emp::block key_id = emp::zero_block();
+    bool stored = false;
+    if (store != nullptr) {
+        // Tell OT Receiver which public key is stored
+        stored = store->load_public_key(pkc, public_key, key_id);
+        if (!stored) key_id = emp::zero_block();
+        send->add_task(channel_id, sizeof(emp::block), (char*) &key_id);
+
+        Buffer task = recv->get_task(channel_id);
+        emp::block recv_key_id;
+        memcpy(&recv_key_id, task.data(), sizeof(emp::block));
+        stored = stored && emp::cmpBlock(&key_id, &recv_key_id, 1);
+        key_id = recv_key_id;
+    }
 
-    pkc->encryptor = new Encryptor(pkc->context, public_key);
-    pkc->evaluator = new Evaluator(pkc->context);
-    pkc->batch_encoder = new BatchEncoder(pkc->context);
+    if (!stored) {
+        // Receive public key from OT Receiver
+        Buffer task = recv->get_task(channel_id);
+        BufferInStream ss(task);
+        public_key.load(pkc->context, ss);
+        if (store != nullptr) {
+            if (!store->save_public_key(pkc, public_key, key_id)) {
+                perror("warning: public key not stored");
+            }
+        }
+    }
 
     // Also receive secret key from OT Receiver in the debug mode
 #ifdef HE_DEBUG
-    task = recv->get_task(channel_id);
-    stringstream ss_sk;
-    ss_sk.write(task.data, task.length);
+    Buffer task = recv->get_task(channel_id);
+    BufferInStream ss_sk(task);
 
     SecretKey secret_key;
     secret_key.load(pkc->context, ss_sk);
 
-    pkc->decryptor = new Decryptor(pkc->context, secret_key);
+    pkc->set_keys(public_key, &secret_key);
+#else
+    pkc->set_keys(public_key, nullptr);
 #endif
 }
 
-void SetupWorkerThread::run_receiver() {
-    KeyGenerator keygen(pkc->context);
-    PublicKey public_key = keygen.public_key();
-    SecretKey secret_key = keygen.secret_key();
+void SetupJob::run_receiver() {
+    PublicKey public_key;
+    SecretKey secret_key;
+    emp::block key_id;
+    bool stored = (store != nullptr)
+        && store->load_key_pair(pkc, public_key, secret_key, key_id);
+    if (!stored) {
+        KeyGenerator keygen(pkc->context);
+        public_key = keygen.public_key();
+        secret_key = keygen.secret_key();
+        if (store != nullptr) {
+            emp::PRG prg;
+            prg.random_block(&key_id, 1);
+            if (!store->save_key_pair(pkc, public_key, secret_key, key_id)) {
+                perror("warning: key pair not stored");
+            }
+        }
+    }
+
+    pkc->set_keys(public_key, &secret_key);
 
-    pkc->encryptor = new Encryptor(pkc->context, public_key);
-    pkc->evaluator = new Evaluator(pkc->context);
-    pkc->decryptor = new Decryptor(pkc->context, secret_key);
-    pkc->batch_encoder = new BatchEncoder(pkc->context);
+    bool send_public_key = true;
+    if (store != nullptr) {
+        // Reply to OT Sender with the id of the key pair in use
+        Buffer task = recv->get_task(channel_id);
+        emp::block sender_key_id;
+        memcpy(&sender_key_id, task.data(), sizeof(emp::block));
+        send->add_task(channel_id, sizeof(emp::block), (char*) &key_id);
+        send_public_key = !emp::cmpBlock(&key_id, &sender_key_id, 1);
+    }
 
     // Send public key to OT Sender
-    stringstream ss;
-    public_key.save(ss);
-    string str = ss.str();
-    send->add_task(channel_id, str.size(), str.c_str());
+    if (send_public_key) {
+        BufferOutStream ss;
+        public_key.save(ss);
+        send->add_task(channel_id, ss.take());
+    }
 
     // Also send the secret key to OT Sender in the debug mode
 #ifdef HE_DEBUG
-    stringstream ss_sk;
+    BufferOutStream ss_sk;
     secret_key.save(ss_sk);
-    string str_sk = ss_sk.str();
-    send->add_task(channel_id, str_sk.size(), str_sk.c_str());
+    send->add_task(channel_id, ss_sk.take());
 #endif
 }
 
-void ReceiverWorkerThread::run() {
+// Split num_msgs messages of msg_bytes bytes into slots_per_msg slots of
+// sizeof(T) bytes each. The last slot of a message may be partly filled.
+template<typename T>
+static void slice_messages(const uint8_t* m, int msg_bytes, int num_msgs,
+        int slots_per_msg, uint64_t* slots) {
+    if (msg_bytes == slots_per_msg * (int) sizeof(T)) {
+        // Messages fill their slots, so the slots are consecutive words
+        size_t num_slots = (size_t) num_msgs * slots_per_msg;
+        for (size_t i = 0; i < num_slots; i++) {
+            T word;
+            memcpy(&word, m + i * sizeof(T), sizeof(T));
+            slots[i] = word;
+        }
+        return;
+    }
+    int last_bytes = msg_bytes - (slots_per_msg - 1) * sizeof(T);
+    for (int i = 0; i < num_msgs; i++) {
+        const uint8_t* msg = m + (size_t) i * msg_bytes;
+        uint64_t* msg_slots = slots + (size_t) i * slots_per_msg;
+        for (int j = 0; j < slots_per_msg - 1; j++) {
+            T word;
+            memcpy(&word, msg + j * sizeof(T), sizeof(T));
+            msg_slots[j] = word;
+        }
+        T word = 0;
+        memcpy(&word, msg + (slots_per_msg - 1) * sizeof(T), last_bytes);
+        msg_slots[slots_per_msg - 1] = word;
+    }
+}
+
+// Inverse of slice_messages
+template<typename T>
+static void join_slots(const uint64_t* slots, int msg_bytes, int num_msgs,
+        int slots_per_msg, uint8_t* m) {
+    if (msg_bytes == slots_per_msg * (int) sizeof(T)) {
+        size_t num_slots = (size_t) num_msgs * slots_per_msg;
+        for (size_t i = 0; i < num_slots; i++) {
+            T word = slots[i];
+            memcpy(m + i * sizeof(T), &word, sizeof(T));
+        }
+        return;
+    }
+    int last_bytes = msg_bytes - (slots_per_msg - 1) * sizeof(T);
+    for (int i = 0; i < num_msgs; i++) {
+        uint8_t* msg = m + (size_t) i * msg_bytes;
+        const uint64_t* msg_slots = slots + (size_t) i * slots_per_msg;
+        for (int j = 0; j < slots_per_msg - 1; j++) {
+            T word = msg_slots[j];
+            memcpy(msg + j * sizeof(T), &word, sizeof(T));
+        }
+        T word = msg_slots[slots_per_msg - 1];
+        memcpy(msg + (slots_per_msg - 1) * sizeof(T), &word, last_bytes);
+    }
+}
+
+// Slots are 16 bits wide with the 17-bit plaintext modulus, and 32 bits wide
+// with the 33-bit one
+static void slice_messages(const uint8_t* m, int msg_bytes, int num_msgs,
+        int slot_bitlen, int slots_per_msg, uint64_t* slots) {
+    if (slot_bitlen == 16) {
+        slice_messages<uint16_t>(m, msg_bytes, num_msgs, slots_per_msg, slots);
+    } else {
+        assert(slot_bitlen == 32);
+        slice_messages<uint32_t>(m, msg_bytes, num_msgs, slots_per_msg, slots);
+    }
+}
+
+static void join_slots(const uint64_t* slots, int msg_bytes, int num_msgs,
+        int slot_bitlen, int slots_per_msg, uint8_t* m) {
+    if (slot_bitlen == 16) {
+        join_slots<uint16_t>(slots, msg_bytes, num_msgs, slots_per_msg, m);
+    } else {
+        assert(slot_bitlen == 32);
+        join_slots<uint32_t>(slots, msg_bytes, num_msgs, slots_per_msg, m);
+    }
+}
+
+void ReceiverJob::run() {
     // Bitlength of OT messages to be embedded in slots
     int slot_bitlen = pkc->plain_modulus_bitlen - 1;
     int slots_per_msg = ceil((double) bitlen/slot_bitlen);
-    int msgs_per_ctxt = floor((double) pkc->poly_degree/slots_per_msg);
     // Number of OT instances
     int num_iters = end_id - start_id;
-    int num_cts = ceil((double) num_iters / msgs_per_ctxt) ;
     int slot_count = pkc->poly_degree;
 
-    // Plaintext vectors for OT Receiver choice bits
-    vector<vector<uint64_t>> pb(num_cts);
-
-    for(int h = 0; h < num_cts; h++) {
-        pb[h].resize(slot_count, 0);
-        int offset = h * msgs_per_ctxt;
-        for(int i = 0; i < msgs_per_ctxt && offset + i < num_iters; i++) {
-            int index = start_id + offset + i;
-            // Replicating the same choice bit in slots_per_msg slots
-            for(int j = 0; j < slots_per_msg; j++) {
-                pb[h][i*slots_per_msg + j] = (uint64_t) b[index];
-            }
+    // Plaintext vector for OT Receiver choice bits
+    vector<uint64_t> pb(slot_count, 0);
+    for(int i = 0; i < num_iters; i++) {
+        int index = start_id + i;
+        // Replicating the same choice bit in slots_per_msg slots
+        for(int j = 0; j < slots_per_msg; j++) {
+            pb[i*slots_per_msg + j] = (uint64_t) b[index];
         }
     }
 
-    vector<vector<uint64_t>> pm_b(num_cts);
-    vector<Plaintext> ppb(num_cts);
-    vector<Plaintext> ppm_b(num_cts);
-    vector<Ciphertext> cb(num_cts);
-    vector<Ciphertext> cm_b(num_cts);
-
-    for(int h = 0; h < num_cts; h++) {
-        pm_b[h].resize(slot_count);
-
-        pkc->batch_encoder->encode(pb[h], ppb[h]);
-        pkc->encryptor->encrypt(ppb[h], cb[h]);
+    CryptoWorker& w = pkc->worker();
+    Plaintext ppb(w.pool);
+    Ciphertext cb(w.pool);
+    w.batch_encoder->encode(pb, ppb);
+    w.encryptor->encrypt(ppb, cb, w.pool);
 
-        // Send cb (encryption of choice bit) to OT Sender
-        stringstream ss;
-        cb[h].save(ss);
-        string str = ss.str();
-        send->add_task(channel_id, str.size(), str.c_str());
-    }
+    // Send cb (encryption of choice bit) to OT Sender
+    BufferOutStream ss;
+    cb.save(ss);
+    send->add_task(channel_id, ss.take(), seq);
+}
 
-    for(int h = 0; h < num_cts; h++) {
-        // Receive cm_b (encryption of message corresponding to choice bit) from OT Sender
-        RecvTask task = recv->get_task(channel_id);
-        stringstream ss;
-        ss.write(task.data, task.length);
-        cm_b[h].load(pkc->context, ss);
-        pkc->decryptor->decrypt(cm_b[h], ppm_b[h]);
-        pkc->batch_encoder->decode(ppm_b[h], pm_b[h]);
-    }
+void DecryptJob::run() {
+    // Bitlength of OT messages embedded in slots
+    int slot_bitlen = pkc->plain_modulus_bitlen - 1;
+    int slots_per_msg = ceil((double) bitlen/slot_bitlen);
+    // Number of OT instances
+    int num_iters = end_id - start_id;
+    int slot_count = pkc->poly_degree;
 
-    for(int h = 0; h < num_cts; h++){
-        int offset = h * msgs_per_ctxt;
-        for(int i = 0; i < msgs_per_ctxt && offset + i < num_iters; i++) {
-            int index = start_id + offset + i;
-            // Reconstruct the message m_b by concatenating
-            // slots_per_msg integers of slot_bitlen-bits
-            mpz_set_ui(m_b[index], pm_b[h][i * slots_per_msg]);
-            for(int j = 1; j < slots_per_msg; j++){
-                // Left shift by slot_bitlen bits
-                mpz_mul_2exp(m_b[index], m_b[index], slot_bitlen);
-                // Addition of message component to the lower slot_bitlen-bits of m_b
-                mpz_add_ui(m_b[index], m_b[index], pm_b[h][i * slots_per_msg + j]);
-            }
-        }
-    }
+    // cm_b (encryption of message corresponding to choice bit) from OT Sender
+    BufferInStream ss(cm_b);
+    CryptoWorker& w = pkc->worker();
+    Ciphertext ct(w.pool);
+    Plaintext ppm_b(w.pool);
+    vector<uint64_t> pm_b(slot_count);
+    ct.load(pkc->context, ss);
+    cm_b.release();
+    w.decryptor->decrypt(ct, ppm_b);
+    w.batch_encoder->decode(ppm_b, pm_b, w.pool);
+
+    // Reconstruct the messages m_b from their slots
+    int msg_bytes = (bitlen + 7) / 8;
+    join_slots(pm_b.data(), msg_bytes, num_iters, slot_bitlen, slots_per_msg,
+            m_b + (size_t) start_id * msg_bytes);
 }
 
-void SenderWorkerThread::run() {
-    shared_ptr<UniformRandomGenerator> generator(FastPRNGFactory().create());
+void SenderJob::run() {
     // Bitlength of OT Sender messages to be embedded in slots
     int slot_bitlen = pkc->plain_modulus_bitlen - 1;
     int slots_per_msg = ceil((double) bitlen/slot_bitlen);
-    int msgs_per_ctxt = floor((double) pkc->poly_degree/slots_per_msg);
     // Number of OT instances
     int num_iters = end_id - start_id;
-    int num_cts = ceil((double) num_iters / msgs_per_ctxt) ;
     int slot_count = pkc->poly_degree;
 
     // Plaintext vector with 1 in all slots
-    vector<uint64_t> p_1(slot_count);
-    for(int i = 0; i < slot_count; i++){
-        p_1[i] = 1ULL;
-    }
+    vector<uint64_t> p_1(slot_count, 1ULL);
 
     // Plaintext vectors for OT Sender messages
-    vector<vector<uint64_t>> pm_0(num_cts), pm_1(num_cts);
-
-    mpz_t temp_0, temp_1;
-    // mask is used to extract the lower slot_bitlen-bits from an integer
-    mpz_t mask;
-    // slice holds the slot_bitlen-bits long components of OT Sender messages
-    // extracted using masking
-    mpz_t slice;
-    mpz_inits(temp_0, temp_1, slice, mask, NULL);
-    // mask = (1 << slot_bitlen) - 1;
-    mpz_set_ui(mask, 1);
-    mpz_mul_2exp(mask, mask, slot_bitlen);
-    mpz_sub_ui(mask, mask, 1);
-    for(int h = 0; h < num_cts; h++) {
-        pm_0[h].resize(slot_count);
-        pm_1[h].resize(slot_count);
-        int offset = h * msgs_per_ctxt;
-        for(int i = 0; i < msgs_per_ctxt && offset + i < num_iters; i++) {
-            int index = start_id + offset + i;
-            mpz_set(temp_0, m_0[index]);
-            mpz_set(temp_1, m_1[index]);
-            for(int j = slots_per_msg - 1; j >= 0; j--) {
-                // Extraction of lower slot_bitlen-bits of OT Sender messages
-                mpz_and(slice, temp_0, mask);
-                pm_0[h][i*slots_per_msg + j] = mpz_get_ui(slice);
-                mpz_and(slice, temp_1, mask);
-                pm_1[h][i*slots_per_msg + j] = mpz_get_ui(slice);
-                // Right shift by slot_bitlen bits
-                mpz_fdiv_q_2exp(temp_0, temp_0, slot_bitlen);
-                mpz_fdiv_q_2exp(temp_1, temp_1, slot_bitlen);
-            }
-        }
-    }
-    mpz_clears(temp_0, temp_1, slice, mask, NULL);
-
+    vector<uint64_t> pm_0(slot_count), pm_1(slot_count);
+    int msg_bytes = (bitlen + 7) / 8;
+    slice_messages(m_0 + (size_t) start_id * msg_bytes, msg_bytes, num_iters,
+            slot_bitlen, slots_per_msg, pm_0.data());
+    slice_messages(m_1 + (size_t) start_id * msg_bytes, msg_bytes, num_iters,
+            slot_bitlen, slots_per_msg, pm_1.data());
+
+    CryptoWorker& w = pkc->worker();
     // Plaintexts for OT Sender messages
-    vector<Plaintext> ppm_0(num_cts), ppm_1(num_cts);
+    Plaintext ppm_0(w.pool), ppm_1(w.pool);
     // Plaintext with 1 in all slots
-    Plaintext pp_1;
-    vector<Ciphertext> cb(num_cts), cm_b(num_cts);
-
-    for(int h = 0; h < num_cts; h++){
-        pkc->batch_encoder->encode(pm_0[h], ppm_0[h]);
-        pkc->batch_encoder->encode(pm_1[h], ppm_1[h]);
-        pkc->batch_encoder->encode(p_1, pp_1);
-
-        // Receive cb (encryption of choice bit) from OT Receiver
-        RecvTask task = recv->get_task(channel_id);
-        stringstream ss;
-        ss.write(task.data, task.length);
-        cb[h].load(pkc->context, ss);
-    }
+    Plaintext pp_1(w.pool);
+    Ciphertext ct_b(w.pool), cm_b(w.pool);
 
-    for(int h = 0; h < num_cts; h++){
-#ifdef HE_DEBUG
-        if (!h) {
-            cout << "Noise budget of fresh encryption: "
-                << pkc->decryptor->invariant_noise_budget(cb[h]) << " bits" << endl;
-        }
-#endif
+    w.batch_encoder->encode(pm_0, ppm_0);
+    w.batch_encoder->encode(pm_1, ppm_1);
+    w.batch_encoder->encode(p_1, pp_1);
+
+    // cb (encryption of choice bit) from OT Receiver
+    BufferInStream ss_b(cb);
+    ct_b.load(pkc->context, ss_b);
+    cb.release();
 
-        // cm_b = m_0 * (1 - cb) + m_1 * (cb)
-        pkc->evaluator->negate(cb[h], cm_b[h]);
-        pkc->evaluator->add_plain_inplace(cm_b[h], pp_1);
-        pkc->evaluator->multiply_plain_inplace(cm_b[h], ppm_0[h]);
-        pkc->evaluator->multiply_plain_inplace(cb[h], ppm_1[h]);
-        pkc->evaluator->add_inplace(cm_b[h], cb[h]);
 #ifdef HE_DEBUG
-        if (!h) {
-            cout << "Noise budget after OT computation: "
-                << pkc->decryptor->invariant_noise_budget(cm_b[h]) << " bits" << endl;
-        }
+    if (!start_id) {
+        cout << "Noise budget of fresh encryption: "
+            << w.decryptor->invariant_noise_budget(ct_b) << " bits" << endl;
+    }
 #endif
 
-        // Switching to a smaller ciphertext modulus for efficiency
-        if (pkc->plain_modulus_bitlen == 33) {
-            pkc->evaluator->mod_switch_to_next_inplace(cm_b[h]);
+    // cm_b = m_0 * (1 - cb) + m_1 * (cb)
+    w.evaluator->negate(ct_b, cm_b);
+    w.evaluator->add_plain_inplace(cm_b, pp_1);
+    w.evaluator->multiply_plain_inplace(cm_b, ppm_0, w.pool);
+    w.evaluator->multiply_plain_inplace(ct_b, ppm_1, w.pool);
+    w.evaluator->add_inplace(cm_b, ct_b);
 #ifdef HE_DEBUG
-            if (!h) {
-                cout << "Noise budget after mod-switch: "
-                    << pkc->decryptor->invariant_noise_budget(cm_b[h]) << " bits" << endl;
-            }
+    if (!start_id) {
+        cout << "Noise budget after OT computation: "
+            << w.decryptor->invariant_noise_budget(cm_b) << " bits" << endl;
+    }
 #endif
-        }
 
-        // Noise Flooding required for circuit privacy
-        parms_id_type parms_id = cm_b[h].parms_id();
-        shared_ptr<const SEALContext::ContextData> context_data_
-            = pkc->context->context_data(parms_id);
-        // Noise bitlengths determined heuristically to guarantee
-        // statistical security of at least 40 bits
-        flood_ciphertext(cm_b[h], context_data_, 89 - pkc->plain_modulus_bitlen);
+    // Switching to a smaller ciphertext modulus for efficiency
+    if (pkc->plain_modulus_bitlen == 33) {
+        w.evaluator->mod_switch_to_next_inplace(cm_b, w.pool);
 #ifdef HE_DEBUG
-        if (!h) {
-            cout << "Noise budget after noise flooding: "
-                << pkc->decryptor->invariant_noise_budget(cm_b[h]) << " bits" << endl;
+        if (!start_id) {
+            cout << "Noise budget after mod-switch: "
+                << w.decryptor->invariant_noise_budget(cm_b) << " bits" << endl;
         }
 #endif
+    }
 
-        // Switching to a smaller ciphertext modulus for efficiency
-        pkc->evaluator->mod_switch_to_next_inplace(cm_b[h]);
+    // Noise Flooding required for circuit privacy
+    parms_id_type parms_id = cm_b.parms_id();
+    shared_ptr<const SEALContext::ContextData> context_data_
+        = pkc->context->context_data(parms_id);
+    // Noise bitlengths determined heuristically to guarantee
+    // statistical security of at least 40 bits
+    flood_ciphertext(cm_b, context_data_, 89 - pkc->plain_modulus_bitlen, w.pool);
 #ifdef HE_DEBUG
-        if (!h) {
-            cout << "Noise budget after mod-switch: "
-                << pkc->decryptor->invariant_noise_budget(cm_b[h]) << " bits" << endl;
-        }
+    if (!start_id) {
+        cout << "Noise budget after noise flooding: "
+            << w.decryptor->invariant_noise_budget(cm_b) << " bits" << endl;
+    }
 #endif
-        // Send cm_b (encryption of message corresponding to choice bit) to OT Receiver
-        stringstream ss;
-        cm_b[h].save(ss);
-        string str = ss.str();
-        send->add_task(channel_id, str.size(), str.c_str());
+
+    // Switching to a smaller ciphertext modulus for efficiency
+    w.evaluator->mod_switch_to_next_inplace(cm_b, w.pool);
+#ifdef HE_DEBUG
+    if (!start_id) {
+        cout << "Noise budget after mod-switch: "
+            << w.decryptor->invariant_noise_budget(cm_b) << " bits" << endl;
     }
+#endif
+    // Send cm_b (encryption of message corresponding to choice bit) to OT Receiver
+    BufferOutStream ss;
+    cm_b.save(ss);
+    send->add_task(channel_id, ss.take(), seq);
 }
@@ -1,30 +1,100 @@
 #ifndef PQ_OT_MAIN_H__
 #define PQ_OT_MAIN_H__
-#include "pq-ot/io-thread.h"
+#include "pq-ot/worker-pool.h"
+#include <mutex>
 #include "seal/seal.h"
 #include "seal/randomgen.h"
 #include "seal/encryptor.h"
 #include "seal/util/polyarithsmallmod.h"
+#include "seal/util/uintarithsmallmod.h"
 #include "seal/util/randomtostd.h"
 #include "gmp.h"
 #include "gmpxx.h"
 
 // #define HE_DEBUG
 
-void divide_iterations(std::vector<int> &iters_per_thread, int num_iters,
-        int num_threads, int multiplier = 1);
-void sample_poly_coeffs_uniform(uint64_t *poly, uint32_t bitlen,
-        std::shared_ptr<seal::UniformRandomGenerator> random,
+void sample_poly_coeffs_uniform(uint64_t *poly, uint32_t bitlen, emp::PRG &prg,
         std::shared_ptr<const seal::SEALContext::ContextData> &context_data);
 void flood_ciphertext(seal::Ciphertext &ct,
         std::shared_ptr<const seal::SEALContext::ContextData> &context_data,
         uint32_t noise_len, seal::MemoryPoolHandle pool = seal::MemoryManager::GetPool());
 
+// HE parameter sets supported by PQOT, from the smallest ring to the largest
+enum PQOTParamSet {
+    PARAMS_4096_17 = 0, // lowest latency for small batches
+    PARAMS_8192_17,
+    PARAMS_16384_33,    // highest throughput for large batches
+    NUM_PARAM_SETS
+};
+
+struct PQOTParams {
+    int poly_degree;
+    int plain_modulus_bitlen;
+    // Number of ciphertext moduli of the encrypted choice bits
+    int num_moduli;
+};
+
+extern const PQOTParams pqot_params[NUM_PARAM_SETS];
+
+// Cost model for num_ot OTs on bitlen-bit messages computed by num_threads
+// workers, including the key exchange if the parameter set has no keys yet
+double estimate_ot_cost(int param_set, int num_ot, int bitlen, int num_threads,
+        bool has_keys);
+// Parameter set with the lowest estimated cost
+int select_param_set(int num_ot, int bitlen, int num_threads, const bool* has_keys);
+
+// Evaluation objects of one thread. Every thread allocates from its own
+// memory pool, so that threads do not contend for SEAL's global pool.
+struct CryptoWorker {
+    seal::MemoryPoolHandle pool;
+    seal::Encryptor* encryptor = nullptr;
+    seal::Evaluator* evaluator = nullptr;
+    seal::BatchEncoder* batch_encoder = nullptr;
+    seal::Decryptor* decryptor = nullptr;
+
+    ~CryptoWorker() {
+        delete encryptor;
+        delete evaluator;
+        delete batch_encoder;
+        delete decryptor;
+    }
+};
+
+// Random generators of SEAL seeded from an emp::PRG, so that they repeat
+// between runs with a fixed default seed. SEAL's FastPRNGFactory starts
+// every generator from its own seed, so the secret key and all encryptions
+// would share their randomness, and the difference of two ciphertexts would
+// reveal the difference of their plaintexts. Here each generator takes a
+// new seed. Generators created on several threads take their seeds in the
+// order they are created, which may differ between runs.
+class PRGRandomFactory: public seal::UniformRandomGeneratorFactory {
+public:
+    std::shared_ptr<seal::UniformRandomGenerator> create() override {
+        uint64_t seed[2];
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            prg.random_data(seed, sizeof(seed));
+        }
+        return std::make_shared<seal::FastPRNG>(seed[0], seed[1]);
+    }
+
+private:
+    emp::PRG prg;
+    std::mutex mutex;
+};
+
+// Context of parms, created once per process. Contexts do not change once
+// created, so every Cryptosystem with the same parameters shares one, and
+// only the first pays for the precomputed tables. Parameters with a random
+// generator of their own get a context of their own.
+std::shared_ptr<seal::SEALContext> get_context(const seal::EncryptionParameters& parms);
+
 class Cryptosystem {
 public:
-    Cryptosystem (int role, int plain_modulus_bitlen, int poly_degree) {
+    Cryptosystem (int role, int plain_modulus_bitlen, int poly_degree, int num_workers = 1) {
         this->poly_degree = poly_degree;
         this->plain_modulus_bitlen = plain_modulus_bitlen;
+        this->num_workers = num_workers;
 
         parms = new seal::EncryptionParameters(seal::scheme_type::BFV);
         parms->set_poly_modulus_degree(poly_degree);
@@ -32,7 +102,8 @@ public:
             case 17: {
                 plain_modulus = 65537; // 17-bit prime
                 std::vector<seal::SmallModulus> q;
-                // 100-bit ciphertext modulus
+                // 100-bit ciphertext modulus, which is below the 109-bit bound
+                // for 128-bit security with poly_degree 4096 as well
                 q.push_back(seal::small_mods_60bit(0));
                 q.push_back(seal::small_mods_40bit(0));
                 parms->set_coeff_modulus(q);
@@ -50,23 +121,64 @@ public:
             }
         }
         parms->set_plain_modulus(plain_modulus);
-        context = seal::SEALContext::Create(*parms);
+        // Keys and encryptions repeat between runs once the PRGs have a
+        // fixed seed, see emp::PRG::set_default_seed
+        if (emp::PRG::has_default_seed()) {
+            parms->set_random_generator(std::make_shared<PRGRandomFactory>());
+        }
+        context = get_context(*parms);
+    }
+
+    ~Cryptosystem() {
+        for(size_t i = 0; i < workers.size(); i++) {
+            delete workers[i];
+        }
+        delete parms;
+    }
+
+    // Create the evaluation objects of every worker thread, and of the other
+    // threads. secret_key is only needed for decryption.
+    void set_keys(const seal::PublicKey& public_key, const seal::SecretKey* secret_key) {
+        workers.resize(num_workers + 1);
+        for(int i = 0; i <= num_workers; i++) {
+            CryptoWorker* w = new CryptoWorker();
+            w->pool = seal::MemoryPoolHandle::New();
+            w->encryptor = new seal::Encryptor(context, public_key);
+            w->evaluator = new seal::Evaluator(context);
+            w->batch_encoder = new seal::BatchEncoder(context);
+            if (secret_key != nullptr) {
+                w->decryptor = new seal::Decryptor(context, *secret_key);
+            }
+            workers[i] = w;
+        }
+    }
+
+    // Evaluation objects of the calling thread. Threads outside the worker
+    // pool, and workers of a larger pool, share the first entry, whose
+    // objects are thread-safe but allocate from a shared memory pool.
+    CryptoWorker& worker() {
+        int id = WorkerPool::current_worker() + 1;
+        if (id < 0 || id >= (int) workers.size()) id = 0;
+        return *workers[id];
     }
 
     seal::EncryptionParameters* parms;
     std::shared_ptr<seal::SEALContext> context;
-    seal::Encryptor* encryptor;
-    seal::Evaluator* evaluator;
-    seal::BatchEncoder* batch_encoder;
-    seal::Decryptor* decryptor;
+    std::vector<CryptoWorker*> workers;
     uint64_t plain_modulus;
     int poly_degree;
     int plain_modulus_bitlen;
+    int num_workers;
 };
 
-class SetupWorkerThread : public BaseThread {
+class KeyStore;
+
+// Key exchange, run by the thread that starts the call. With a key store, OT
+// Sender first sends the id of its stored public key, and OT Receiver only
+// sends its public key if the sender does not hold it already.
+class SetupJob : public Job {
 public:
-    SetupWorkerThread(int role, int channel_id, Cryptosystem* pkc, SendThread* send, RecvThread* recv) {
+    SetupJob(int role, int channel_id, Cryptosystem* pkc, StripedSend* send, StripedRecv* recv) {
         this->role = role;
         this->channel_id = channel_id;
         this->pkc = pkc;
@@ -74,6 +186,10 @@ public:
         this->recv = recv;
     }
 
+    void set_key_store(KeyStore* store) {
+        this->store = store;
+    }
+
     void run_sender();
     void run_receiver();
 
@@ -94,18 +210,26 @@ private:
     int role;
     int channel_id;
     Cryptosystem* pkc;
-    SendThread* send;
-    RecvThread* recv;
+    StripedSend* send;
+    StripedRecv* recv;
+    KeyStore* store = nullptr;
 };
 
-class SenderWorkerThread : public BaseThread {
+// The jobs below handle the OTs with indices in [start_id, end_id) that fit in
+// a single ciphertext, which is sent as message seq on channel channel_id.
+// They never wait for messages, so that the worker pool cannot deadlock.
+// Messages are (bitlen + 7) / 8 bytes long, in little-endian order, and are
+// split into slots of plain_modulus_bitlen - 1 bits, least significant first.
+
+// OT Sender computes the encryption of m_b from the encryption of b
+class SenderJob : public Job {
 public:
-    SenderWorkerThread(int channel_id, int bitlen, Cryptosystem* pkc, SendThread* send, RecvThread* recv) {
+    SenderJob(int channel_id, uint32_t seq, int bitlen, Cryptosystem* pkc, StripedSend* send) {
         this->channel_id = channel_id;
+        this->seq = seq;
         this->bitlen = bitlen;
         this->pkc = pkc;
         this->send = send;
-        this->recv = recv;
     }
 
     void set_iteration_bounds(int start_id, int end_id) {
@@ -113,30 +237,33 @@ public:
         this->end_id = end_id;
     }
 
-    void set_input(mpz_t* m_0, mpz_t* m_1) {
+    void set_input(const uint8_t* m_0, const uint8_t* m_1, Buffer&& cb) {
         this->m_0 = m_0;
         this->m_1 = m_1;
+        this->cb = std::move(cb);
     }
 
     void run();
 private:
     int channel_id;
+    uint32_t seq;
     int start_id, end_id;
     int bitlen;
     Cryptosystem* pkc;
-    SendThread* send;
-    RecvThread* recv;
-    mpz_t *m_0, *m_1;
+    StripedSend* send;
+    const uint8_t *m_0, *m_1;
+    Buffer cb;
 };
 
-class ReceiverWorkerThread : public BaseThread {
+// OT Receiver encrypts the choice bits b
+class ReceiverJob : public Job {
 public:
-    ReceiverWorkerThread(int channel_id, int bitlen, Cryptosystem* pkc, SendThread* send, RecvThread* recv) {
+    ReceiverJob(int channel_id, uint32_t seq, int bitlen, Cryptosystem* pkc, StripedSend* send) {
         this->channel_id = channel_id;
+        this->seq = seq;
         this->bitlen = bitlen;
         this->pkc = pkc;
         this->send = send;
-        this->recv = recv;
     }
 
     void set_iteration_bounds(int start_id, int end_id) {
@@ -144,23 +271,48 @@ public:
         this->end_id = end_id;
     }
 
-    void set_input(bool* b) {
+    void set_input(const bool* b) {
         this->b = b;
     }
 
-    void set_output(mpz_t* m_b) {
+    void run();
+private:
+    int channel_id;
+    uint32_t seq;
+    int start_id, end_id;
+    int bitlen;
+    Cryptosystem* pkc;
+    StripedSend* send;
+    const bool* b;
+};
+
+// OT Receiver decrypts m_b
+class DecryptJob : public Job {
+public:
+    DecryptJob(int bitlen, Cryptosystem* pkc) {
+        this->bitlen = bitlen;
+        this->pkc = pkc;
+    }
+
+    void set_iteration_bounds(int start_id, int end_id) {
+        this->start_id = start_id;
+        this->end_id = end_id;
+    }
+
+    void set_input(Buffer&& cm_b) {
+        this->cm_b = std::move(cm_b);
+    }
+
+    void set_output(uint8_t* m_b) {
         this->m_b = m_b;
     }
 
     void run();
 private:
-    int channel_id;
     int start_id, end_id;
     int bitlen;
     Cryptosystem* pkc;
-    SendThread* send;
-    RecvThread* recv;
-    mpz_t* m_b;
-    bool* b;
+    Buffer cm_b;
+    uint8_t* m_b;
 };
 #endif //RLWE_OT_MAIN_H__
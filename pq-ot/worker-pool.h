@@ -0,0 +1,200 @@
+#ifndef PQ_OT_WORKER_POOL_H__
+#define PQ_OT_WORKER_POOL_H__
+#include "pq-ot/io-thread.h"
+#include <deque>
+
+// Unit of work submitted to a WorkerPool
+class Job {
+public:
+    virtual ~Job() {};
+
+    virtual void run() = 0;
+
+    // Runs the job and wakes up the threads waiting for it
+    void execute() {
+        run();
+        std::unique_lock<std::mutex> lock(done_mutex);
+        done = true;
+        done_cond.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(done_mutex);
+        while(!done) {
+            done_cond.wait(lock);
+        }
+    }
+
+private:
+    bool done = false;
+    std::mutex done_mutex;
+    std::condition_variable done_cond;
+};
+
+class WorkerPool;
+
+class WorkerThread: public BaseThread {
+public:
+    WorkerThread(WorkerPool* pool, int id) {
+        this->pool = pool;
+        this->id = id;
+    }
+
+    void run();
+
+private:
+    WorkerPool* pool;
+    int id;
+};
+
+// Threads that live as long as the pool and run the submitted jobs. Jobs are
+// spread over per-thread deques: a thread takes jobs from the front of its own
+// deque, and steals from the back of the others when it runs out, so that the
+// slowest thread does not set the time of a batch. Jobs submitted by a worker
+// thread go to its own deque, and others are spread round-robin. Only the
+// deques have locks; the number of queued jobs is atomic, and the threads
+// only take the lock of the condition variable to sleep or to wake a
+// sleeping thread. Jobs are owned by the caller.
+class WorkerPool {
+public:
+    WorkerPool(int num_threads) {
+        deques.resize(num_threads);
+        workers.resize(num_threads);
+        for(int i = 0; i < num_threads; i++) {
+            deques[i] = new WorkDeque();
+        }
+        for(int i = 0; i < num_threads; i++) {
+            workers[i] = new WorkerThread(this, i);
+            workers[i]->start();
+        }
+    }
+
+    ~WorkerPool() {
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        stopping = true;
+        sleep_cond.notify_all();
+        lock.unlock();
+        // A thread may still steal from any deque until it sees the pool
+        // stopping, so the deques go once all the threads are done
+        for(size_t i = 0; i < workers.size(); i++) {
+            workers[i]->wait();
+            delete workers[i];
+        }
+        for(size_t i = 0; i < deques.size(); i++) {
+            delete deques[i];
+        }
+    }
+
+    void submit(Job* job) {
+        int id = (current_pool() == this) ? current_worker() : -1;
+        WorkDeque* deque = deques[(id >= 0) ? id : next_deque++ % deques.size()];
+        std::unique_lock<std::mutex> deque_lock = lock_timed(deque->mutex, lock_wait_ns);
+        deque->jobs.push_back(job);
+        deque_lock.unlock();
+        // Either a thread going to sleep sees the job, or this sees the
+        // thread and wakes it
+        pending++;
+        if (sleepers > 0) {
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            lock.unlock();
+            sleep_cond.notify_one();
+        }
+    }
+
+    int size() const {
+        return workers.size();
+    }
+
+    // Index of the calling thread in its pool, or -1 outside worker threads
+    static int& current_worker() {
+        static thread_local int id = -1;
+        return id;
+    }
+
+    // Pool of the calling thread, or nullptr outside worker threads
+    static WorkerPool*& current_pool() {
+        static thread_local WorkerPool* pool = nullptr;
+        return pool;
+    }
+
+    // Time spent waiting for the locks of the pool, in nanoseconds. Idle
+    // threads waiting for jobs are not counted.
+    uint64_t lock_wait_time() const {
+        return lock_wait_ns;
+    }
+
+    // Blocks until a job is available for thread id, or returns nullptr once
+    // the pool is stopping and no job is left
+    Job* next_job(int id) {
+        while (true) {
+            Job* job = take_job(id);
+            if (job != nullptr) {
+                pending--;
+                return job;
+            }
+            std::unique_lock<std::mutex> lock(sleep_mutex);
+            sleepers++;
+            while (pending <= 0 && !stopping) {
+                sleep_cond.wait(lock);
+            }
+            sleepers--;
+            if (pending <= 0) {
+                return nullptr;
+            }
+        }
+    }
+
+private:
+    struct WorkDeque {
+        std::mutex mutex;
+        std::deque<Job*> jobs;
+    };
+
+    // Takes a job from the front of the deque of thread id, or from the back
+    // of another one
+    Job* take_job(int id) {
+        int n = deques.size();
+        for(int k = 0; k < n; k++) {
+            WorkDeque* deque = deques[(id + k) % n];
+            std::unique_lock<std::mutex> deque_lock = lock_timed(deque->mutex, lock_wait_ns);
+            if (!deque->jobs.empty()) {
+                Job* job;
+                if (k == 0) {
+                    job = deque->jobs.front();
+                    deque->jobs.pop_front();
+                } else {
+                    job = deque->jobs.back();
+                    deque->jobs.pop_back();
+                }
+                return job;
+            }
+        }
+        return nullptr;
+    }
+
+    std::vector<WorkDeque*> deques;
+    std::vector<WorkerThread*> workers;
+    std::atomic<uint64_t> next_deque{0};
+    std::atomic<uint64_t> lock_wait_ns{0};
+    // Number of queued jobs that no thread has taken yet. A job may be taken
+    // just before it is counted, so the count may briefly be negative.
+    std::atomic<int64_t> pending{0};
+    // Threads sleeping, or about to, until a job is queued
+    std::atomic<int> sleepers{0};
+    bool stopping = false;
+    std::mutex sleep_mutex;
+    std::condition_variable sleep_cond;
+};
+
+inline void WorkerThread::run() {
+    WorkerPool::current_worker() = id;
+    WorkerPool::current_pool() = pool;
+    while(true) {
+        Job* job = pool->next_job(id);
+        if(job == nullptr) {
+            return;
+        }
+        job->execute();
+    }
+}
+#endif //PQ_OT_WORKER_POOL_H__
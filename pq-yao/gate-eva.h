@@ -5,7 +5,9 @@
 #include "emp-tool/utils/utils.h"
 #include "emp-tool/execution/circuit_execution.h"
 #include "pq-yao/garble-gates.h"
+#include "pq-yao/pending-labels.h"
 #include <iostream>
+#include <functional>
 
 namespace emp {
 template<typename T>
@@ -14,6 +16,12 @@ public:
     // Incremented after every gate
 	uint64_t gid = 0;
 	T * io;
+    // Set once input labels may be placeholders of OTs running in the background
+    PendingLabels* pending = nullptr;
+    // Set while input labels are placeholders of OTs that have not run yet,
+    // which flush_ot runs before the next gate
+    bool ot_queued = false;
+    std::function<void()> flush_ot;
 
 	GateEva(T * io) :io(io) {};
 
@@ -29,6 +37,12 @@ public:
 
 	void and_gate(Label& c0, Label& c1, const Label& a0, const Label& a1,
             const Label& b0, const Label& b1) override {
+        if (ot_queued) flush_ot();
+        // Inputs still holding placeholders get their labels in place
+        if (pending != nullptr && (pending->is_placeholder(a0) || pending->is_placeholder(b0))) {
+            pending->settle(a0);
+            pending->settle(b0);
+        }
         // If one of the input labels is public, simply bitwise-AND the
         // input labels to get the output label
 		if (is_public(a0) or is_public(b0)) {
@@ -45,6 +59,11 @@ public:
 
 	void xor_gate(Label& c0, Label& c1, const Label& a0, const Label& a1,
             const Label& b0, const Label& b1) override {
+        if (ot_queued) flush_ot();
+        if (pending != nullptr && (pending->is_placeholder(a0) || pending->is_placeholder(b0))) {
+            pending->settle(a0);
+            pending->settle(b0);
+        }
         // If one of the input labels is 1, the output label is the NOT of the other input label
 		if(isOne(&a0)) not_gate(c0, c1, b0, b1);
 		else if (isOne(&b0)) not_gate(c0, c1, a0, a1);
@@ -60,6 +79,10 @@ public:
         return;
 	}
 	void not_gate(Label &b0, Label &b1, const Label &a0, const Label &a1) override {
+        if (ot_queued) flush_ot();
+        if (pending != nullptr && pending->is_placeholder(a0)) {
+            pending->settle(a0);
+        }
         if (isZero(&a0)) b0 = one_label();
         else if (isOne(&a0)) b0 = zero_label();
         // If the input label is not public, evaluator does nothing
@@ -6,6 +6,7 @@
 #include "emp-tool/execution/circuit_execution.h"
 #include "pq-yao/garble-gates.h"
 #include <iostream>
+#include <functional>
 
 namespace emp {
 template<typename T>
@@ -15,6 +16,10 @@ public:
 	uint64_t gid = 0;
 	T * io;
     PRG prg;
+    // Set while evaluator inputs wait for their OTs, which flush_ot runs
+    // before the next gate
+    bool ot_queued = false;
+    std::function<void()> flush_ot;
 
 	GateGen(T * io) :io(io) {};
 
@@ -31,6 +36,7 @@ public:
 
 	void and_gate(Label& c0, Label& c1, const Label& a0, const Label& a1,
             const Label& b0, const Label& b1) override {
+        if (ot_queued) flush_ot();
         // If one of the input labels is public, simply bitwise-AND the
         // input labels to get the output labels
 		if (is_public(a0)) {
@@ -54,6 +60,7 @@ public:
 
 	void xor_gate(Label& c0, Label& c1, const Label& a0, const Label& a1,
             const Label& b0, const Label& b1) override {
+        if (ot_queued) flush_ot();
         // If one of the input labels is 1, the output label is the NOT of the other input label
 		if(isOne(&a0)) not_gate(c0, c1, b0, b1);
 		else if (isOne(&b0)) not_gate(c0, c1, a0, a1);
@@ -70,6 +77,7 @@ public:
 	}
 
 	void not_gate(Label &b0, Label &b1, const Label &a0, const Label &a1) override {
+        if (ot_queued) flush_ot();
         if (isZero(&a0)) b0 = one_label();
         else if (isOne(&a0)) b0 = zero_label();
         // If the input label is not public, garbler flips the mapping of the input labels
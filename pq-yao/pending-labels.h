@@ -0,0 +1,95 @@
+#ifndef PENDING_LABELS_H__
+#define PENDING_LABELS_H__
+#include "emp-tool/utils/block.h"
+#include <functional>
+#include <future>
+#include <vector>
+
+namespace emp {
+// Tag of the upper 192 bits of a placeholder label
+#define PLACEHOLDER_TAG 0x5a3c96e1f00fd2b4ULL
+// Evaluator's inputs queued for OT without batched_ot before both parties
+// run their OTs, even if no gate uses them yet
+#define INPUT_OT_QUEUE_SIZE (1 << 16)
+// Evaluator's inputs fed without batched_ot whose labels PendingLabels keeps
+// for their placeholders, 128 MiB of labels. Both parties run the OTs of
+// inputs fed past this when they are fed.
+#define DEFERRED_INPUT_LIMIT (1 << 22)
+
+// Evaluator's input labels whose OTs run in the background. Until the OTs are
+// done, the input labels hold placeholders carrying the index of their OT.
+// Placeholders may be copied around like any label, so every gate resolves
+// its inputs, which waits for the OTs the first time a placeholder is used,
+// and writes the label over the placeholder it read, so that later gates on
+// the same wire skip the lookup. Since copies of a placeholder may live
+// anywhere, the labels are kept until the PendingLabels is destroyed, which
+// is why the deferred inputs are capped by DEFERRED_INPUT_LIMIT.
+class PendingLabels {
+public:
+    ~PendingLabels() {
+        wait();
+    }
+
+    static Label placeholder(uint64_t index) {
+        return Label(makeBlock(PLACEHOLDER_TAG, index),
+                makeBlock(PLACEHOLDER_TAG, PLACEHOLDER_TAG));
+    }
+
+    static bool is_placeholder(const Label& a) {
+        const uint64_t* words = (const uint64_t*) &a;
+        // lo = words[0..1], hi = words[2..3]
+        return words[1] == PLACEHOLDER_TAG && words[2] == PLACEHOLDER_TAG
+            && words[3] == PLACEHOLDER_TAG;
+    }
+
+    // Run transfer in the background to compute count labels, and return the
+    // index of the first one. Batches run one after the other.
+    uint64_t start(int count, std::function<void(Label*)> transfer) {
+        wait();
+        uint64_t offset = results.size();
+        results.resize(offset + count);
+        Label* out = results.data() + offset;
+        pending = std::async(std::launch::async, transfer, out);
+        return offset;
+    }
+
+    // Make room for count labels that the caller computes later into
+    // at(index), and return the index of the first one
+    uint64_t reserve(int count) {
+        wait();
+        uint64_t offset = results.size();
+        results.resize(offset + count);
+        return offset;
+    }
+
+    Label* at(uint64_t index) {
+        return results.data() + index;
+    }
+
+    // Block until the running batch is done
+    void wait() {
+        if (pending.valid()) pending.get();
+    }
+
+    const Label& resolve(const Label& a) {
+        if (!is_placeholder(a)) return a;
+        wait();
+        uint64_t index = ((const uint64_t*) &a)[0];
+        return results[index];
+    }
+
+    // Replace a placeholder by its label where it is stored. Wires passed to
+    // the gates as const are never const objects, so a holds a wire the
+    // circuit may write.
+    void settle(const Label& a) {
+        if (!is_placeholder(a)) return;
+        Label label = resolve(a);
+        const_cast<Label&>(a) = label;
+    }
+
+private:
+    std::vector<Label> results;
+    std::future<void> pending;
+};
+}
+#endif// PENDING_LABELS_H__
@@ -2,25 +2,51 @@
 #define SEMIHONEST_EVA_H__
 #include "emp-tool/emp-tool.h"
 #include "pq-ot/pq-ot.h"
+#include "pq-ot/ot-extension.h"
 #include "pq-yao/gate-eva.h"
 
 namespace emp {
 class SemiHonestEva: public ProtocolExecution {
 public:
-	NetIO* io;
-    PQOT *ot;
-	GateEva<NetIO> * gc;
+	IOChannel* io;
+    IOChannel* ot_io = nullptr;
+    PQOT *ot = nullptr;
+    PQOTExtension *ote = nullptr;
+	GateEva<IOChannel> * gc;
     bool batched_ot = false;
     int num_inputs;
     int counter = 0;
-    bool* choice_bits;
-    Label** labels;
-	SemiHonestEva(NetIO *io, GateEva<NetIO> * gc, int num_inputs): ProtocolExecution(BOB) {
+    bool* choice_bits = nullptr;
+    Label** labels = nullptr;
+    // Labels of OTs started by start_batched_ot
+    PendingLabels pending;
+    // Choice bits of inputs fed without batched_ot, whose OTs run together
+    // before the next gate, into the labels from queued_offset on
+    std::vector<uint8_t> queued_bits;
+    uint64_t queued_offset = 0;
+    // Inputs fed without batched_ot so far, which the garbler counts alike
+    uint64_t deferred_inputs = 0;
+	SemiHonestEva(IOChannel *io, GateEva<IOChannel> * gc, int num_inputs,
+            bool ot_extension = false, KeyStore* key_store = nullptr,
+            IOChannel* ot_io = nullptr): ProtocolExecution(BOB) {
 		this->io = io;
 		this->gc = gc;	
-        // Intialize the OT instance and exchange the public key
-        ot = new PQOT(io, BOB);
-        ot->keygen();
+        this->ot_io = ot_io;
+        // OTs run on ot_io if given, so that they can overlap garbling on io
+        IOChannel* pqot_io = (ot_io != nullptr) ? ot_io : io;
+        // If ot_extension is set, the input OTs are extended from base OTs,
+        // otherwise intialize the OT instance and exchange the public key,
+        // which is skipped if both parties hold it in key_store
+        if(ot_extension) {
+            ote = new PQOTExtension(pqot_io, BOB);
+            ote->set_key_store(key_store);
+            ote->setup();
+        } else {
+            ot = new PQOT(pqot_io, BOB);
+            ot->set_key_store(key_store);
+            ot->keygen();
+        }
+        gc->flush_ot = [this]() { flush_input_ot(); };
         // If num_inputs > 0, turn on the batched_ot mode,
         // where all the input OTs are done together, and
         // allocate enough space to store the input labels
@@ -32,17 +58,18 @@ public:
         };
 	}
 	~SemiHonestEva() {
+        pending.wait();
 		delete ot;
+        delete ote;
         delete[] labels;
         delete[] choice_bits;
 	}
 
 	void feed(Label* label0, Label* label1, int party, const bool* b, int length) {
-        // If ALICE's (Garbler) input, receive the correct labels for b from garbler directly
+        // If ALICE's (Garbler) input, receive the correct labels for b from garbler directly,
+        // all in one message
 		if(party == ALICE) {
-            for(int i = 0; i < length; i++){
-                io->recv_data(label0 + i, 2 * sizeof(block), true);
-            }
+            io->recv_data(label0, length * sizeof(Label), true);
         // Else, receive the correct labels for b using OT
 		} else {
             // If batching input OTs, store the choice bits and the pointers
@@ -54,69 +81,135 @@ public:
                     labels[counter + i] = label0 + i;
                 }
                 counter += length;
-            // Else perform OT right now to update the labels
+            // Past DEFERRED_INPUT_LIMIT, receive the labels right away, so
+            // that pending stops growing
+            } else if (deferred_inputs + length > DEFERRED_INPUT_LIMIT) {
+                flush_input_ot();
+                recv_label_ot(label0, b, length);
+            // Else give the labels placeholders and queue the OTs, which
+            // both parties run when a gate or reveal comes next, or when
+            // INPUT_OT_QUEUE_SIZE are queued
             } else {
-                mpz_t* temp = new mpz_t[length];
-                bool* temp_b = new bool[length];
-                memcpy(temp_b, b, length * sizeof(bool));
-                for(int i = 0; i < length; i++) {
-                    mpz_init(temp[i]);
-                }
-                ot->recv_ot(temp, temp_b, length, LABEL_BITLEN);
+                deferred_inputs += length;
+                uint64_t offset = pending.reserve(length);
+                if (queued_bits.empty()) queued_offset = offset;
                 for(int i = 0; i < length; i++) {
-                    mpz_export(label0 + i, NULL, 1, sizeof(block), 0, 0, temp[i]);
-                    mpz_clear(temp[i]);
+                    label0[i] = PendingLabels::placeholder(offset + i);
                 }
-                delete[] temp;
+                queued_bits.insert(queued_bits.end(), b, b + length);
+                gc->pending = &pending;
+                gc->ot_queued = true;
+                if (queued_bits.size() >= INPUT_OT_QUEUE_SIZE) flush_input_ot();
             }
 		}
 	}
 
-    // label is evaluator's label corresponding to b
+    // label is evaluator's label corresponding to b. The LSBs (permutation
+    // bits) of all labels that are not public are packed eight to a byte and
+    // exchanged in one message each way.
 	void reveal(bool * b, int party, const Label * label, int length) {
+        flush_input_ot();
+        std::vector<uint8_t> lsbs((length + 7) / 8, 0);
+        std::vector<int> secret;
 		for (int i = 0; i < length; ++i) {
+            // Input labels may still be placeholders
+            pending.settle(label[i]);
+            const Label& lb = label[i];
             // If the label is public, no communication needed
-			if(isOne(&label[i]))
+			if(isOne(&lb))
 				b[i] = true;
-			else if (isZero(&label[i]))
+			else if (isZero(&lb))
 				b[i] = false;
 			else {
-				bool lsb = getLSB(label[i].lo), tmp;
-                // If the value is revealed to BOB or if it has to be made public,
-                // receive the LSB (permutation-bit) of the 0-th label from garbler.
-                // If it matches with the LSB of label, then b = 0, else b = 1
-				if (party == BOB or party == PUBLIC) {
-					io->recv_data(&tmp, 1, true);
-					b[i] = (tmp != lsb);
-                }
-                // If the value is to be revealed to ALICE or if it has to be made public,
-                // send the LSB (permutation-bit) of label to garbler.
-				if (party == ALICE or party == PUBLIC) {
-					io->send_data(&lsb, 1, true);
-				}
+                int k = secret.size();
+                lsbs[k / 8] |= getLSB(lb.lo) << (k % 8);
+                secret.push_back(i);
 			}
 		}
+        if (secret.empty()) return;
+        int num_bytes = (secret.size() + 7) / 8;
+        // If the value is revealed to BOB or if it has to be made public,
+        // receive the LSBs of the 0-th labels from garbler.
+        // If one matches with the LSB of label, then b = 0, else b = 1
+        if (party == BOB or party == PUBLIC) {
+            std::vector<uint8_t> other(num_bytes);
+            io->recv_data(other.data(), num_bytes, true);
+            for(size_t k = 0; k < secret.size(); k++) {
+                b[secret[k]] = ((other[k / 8] ^ lsbs[k / 8]) >> (k % 8)) & 1;
+            }
+        }
+        // If the value is to be revealed to ALICE or if it has to be made public,
+        // send the LSBs of the labels to garbler.
+        if (party == ALICE or party == PUBLIC) {
+            io->send_data(lsbs.data(), num_bytes, true);
+        }
 	}
 
     void do_batched_ot() {
         assert(batched_ot == true);
         // Peform counter OTs together
-        mpz_t* temp = new mpz_t[counter];
-        for(int i = 0; i < counter; i++) {
-            mpz_init(temp[i]);
-        }
-        ot->recv_ot(temp, choice_bits, counter, LABEL_BITLEN);
+        Label* temp = new Label[counter];
+        recv_label_ot(temp, choice_bits, counter);
         for(int i = 0; i < counter; i++) {
-            mpz_export(*(labels + i), NULL, 1, sizeof(block), 0, 0, temp[i]);
-        }
-        // Cleanup
-        for(int i = 0; i < counter; i++) {
-            mpz_clear(temp[i]);
+            *(labels[i]) = temp[i];
         }
         delete[] temp;
         // Turn batched_ot mode off
         batched_ot = false;
     }
+
+    // Give the input labels placeholders and run the OTs in the background on
+    // ot_io. Gates wait for the OTs when they first use a placeholder.
+    void start_batched_ot() {
+        if(ot_io == nullptr) {
+            do_batched_ot();
+            return;
+        }
+        assert(batched_ot == true);
+        int length = counter;
+        uint64_t offset = pending.start(length, [this, length](Label* out) {
+            recv_label_ot(out, choice_bits, length);
+        });
+        for(int i = 0; i < length; i++) {
+            *(labels[i]) = PendingLabels::placeholder(offset + i);
+        }
+        gc->pending = &pending;
+        batched_ot = false;
+    }
+
+    void wait_batched_ot() {
+        pending.wait();
+    }
+
+    // Run the OTs of the queued inputs, which replace their placeholders,
+    // after the batch started by start_batched_ot
+    void flush_input_ot() {
+        wait_batched_ot();
+        gc->ot_queued = false;
+        if (queued_bits.empty()) return;
+        recv_label_ot(pending.at(queued_offset), (const bool*) queued_bits.data(),
+                queued_bits.size());
+        queued_bits.clear();
+    }
+
+    // Precompute random OTs for num_ot evaluator input labels in the offline phase
+    void precompute_ot(int num_ot) {
+        if(ot != nullptr) ot->precompute_rot(num_ot, LABEL_BITLEN);
+    }
+
+    // Receive the labels for b using OT extension if enabled, precomputed
+    // random OTs if enough are left, or PQ-OT otherwise
+    void recv_label_ot(Label* label, const bool* b, int length) {
+        if(ote != nullptr) {
+            ote->recv_ot(label, b, length);
+            return;
+        }
+        if(ot->rot_available(LABEL_BITLEN) >= (uint64_t) length) {
+            ot->recv_ot_precomputed((uint8_t*) label, b, length, LABEL_BITLEN);
+        } else {
+            ot->recv_ot(label, b, length);
+        }
+    }
 };
 }
 
@@ -2,26 +2,52 @@
 #define SEMIHONEST_GEN_H__
 #include "emp-tool/emp-tool.h"
 #include "pq-ot/pq-ot.h"
+#include "pq-ot/ot-extension.h"
 #include "pq-yao/gate-gen.h"
+#include "pq-yao/pending-labels.h"
 #include <iostream>
+#include <future>
 
 namespace emp {
 class SemiHonestGen: public ProtocolExecution {
 public:
-	NetIO* io;
-    PQOT *ot;
+	IOChannel* io;
+    IOChannel* ot_io = nullptr;
+    PQOT *ot = nullptr;
+    PQOTExtension *ote = nullptr;
 	PRG prg;
-	GateGen<NetIO> * gc;
+	GateGen<IOChannel> * gc;
     bool batched_ot = false;
     int num_inputs;
-    Label *labels0, *labels1;
+    Label *labels0 = nullptr, *labels1 = nullptr;
     int counter = 0;
-	SemiHonestGen(NetIO* io, GateGen<NetIO>* gc, int num_inputs): ProtocolExecution(ALICE) {
+    std::future<void> pending_ot;
+    // Labels of evaluator inputs fed without batched_ot, whose OTs run
+    // together before the next gate
+    std::vector<Label> queued0, queued1;
+    // Inputs fed without batched_ot so far, which the evaluator counts alike
+    uint64_t deferred_inputs = 0;
+	SemiHonestGen(IOChannel* io, GateGen<IOChannel>* gc, int num_inputs,
+            bool ot_extension = false, KeyStore* key_store = nullptr,
+            IOChannel* ot_io = nullptr): ProtocolExecution(ALICE) {
 		this->io = io;
 		this->gc = gc;	
-        // Intialize the OT instance and exchange the public key
-        ot = new PQOT(io, ALICE);
-        ot->keygen();
+        this->ot_io = ot_io;
+        // OTs run on ot_io if given, so that they can overlap garbling on io
+        IOChannel* pqot_io = (ot_io != nullptr) ? ot_io : io;
+        // If ot_extension is set, the input OTs are extended from base OTs,
+        // otherwise intialize the OT instance and exchange the public key,
+        // which is skipped if both parties hold it in key_store
+        if(ot_extension) {
+            ote = new PQOTExtension(pqot_io, ALICE);
+            ote->set_key_store(key_store);
+            ote->setup();
+        } else {
+            ot = new PQOT(pqot_io, ALICE);
+            ot->set_key_store(key_store);
+            ot->keygen();
+        }
+        gc->flush_ot = [this]() { flush_input_ot(); };
         // If num_inputs > 0, turn on the batched_ot mode,
         // where all the input OTs are done together, and
         // allocate enough space to store the input labels
@@ -33,7 +59,9 @@ public:
         };
 	}
 	~SemiHonestGen() {
+        wait_batched_ot();
 		delete ot;
+        delete ote;
         delete[] labels0;
         delete[] labels1;
 	}
@@ -42,19 +70,24 @@ public:
         // Sample random labels for the input b
         prg.random_label(label0, length);
         prg.random_label(label1, length);
+        // Set LSB of label1 as 1 ^ s0, where s0 is the permutation bit of
+        // label0, without branching on s0
         for(int i = 0; i < length; i++){
-            // Permutation bit of label0
-            bool s0 = getLSB(label0[i].lo);
-            // Set LSB of label1 as 1 ^ s0
-            if (s0) set_lsb_zero(label1[i].lo);
-            else set_lsb_one(label1[i].lo);
+            label1[i].lo = _mm_or_si128(_mm_andnot_si128(one_, label1[i].lo),
+                    _mm_andnot_si128(label0[i].lo, one_));
         }
-        // If ALICE's (Garbler) input, send the correct label for b to evaluator directly
+        // If ALICE's (Garbler) input, send the correct labels for b to
+        // evaluator directly, gathered into one message
 		if(party == ALICE) {
+            Label* selected = new Label[length];
             for(int i = 0; i < length; i++){
-                if (b[i]) io->send_data(label1 + i, 2 * sizeof(block), true);
-                else io->send_data(label0 + i, 2 * sizeof(block), true);
+                // All ones if b[i], so that the mask picks label1
+                block mask = _mm_set1_epi64x(-(int64_t) b[i]);
+                selected[i].lo = xorBlocks(label0[i].lo, andBlocks(mask, xorBlocks(label0[i].lo, label1[i].lo)));
+                selected[i].hi = xorBlocks(label0[i].hi, andBlocks(mask, xorBlocks(label0[i].hi, label1[i].hi)));
             }
+            io->send_data(selected, length * sizeof(Label), true);
+            delete[] selected;
         // Else, perform OT to send the correct labels for b
 		} else {
             // If batching input OTs, store the labels and increment the counter.
@@ -63,27 +96,30 @@ public:
                 memcpy(labels0 + counter, label0, length * sizeof(Label));
                 memcpy(labels1 + counter, label1, length * sizeof(Label));
                 counter += length;
-            // Else perform OT right now to send the labels
+            // Past DEFERRED_INPUT_LIMIT, send the labels right away, as the
+            // evaluator stops keeping labels for placeholders
+            } else if (deferred_inputs + length > DEFERRED_INPUT_LIMIT) {
+                flush_input_ot();
+                send_label_ot(label0, label1, length);
+            // Else queue the OTs, which both parties run when a gate or
+            // reveal comes next, or when INPUT_OT_QUEUE_SIZE are queued
             } else {
-                mpz_t* temp0 = new mpz_t[length];
-                mpz_t* temp1 = new mpz_t[length];
-                for(int i = 0; i < length; i++) {
-                    mpz_inits(temp0[i], temp1[i], NULL);
-                    mpz_import(temp0[i], 2, 1, sizeof(block), 0, 0, label0 + i);
-                    mpz_import(temp1[i], 2, 1, sizeof(block), 0, 0, label1 + i);
-                }
-                ot->send_ot(temp0, temp1, length, LABEL_BITLEN);
-                for(int i = 0; i < length; i++) {
-                    mpz_clears(temp0[i], temp1[i], NULL);
-                }
-                delete[] temp0;
-                delete[] temp1;
+                deferred_inputs += length;
+                queued0.insert(queued0.end(), label0, label0 + length);
+                queued1.insert(queued1.end(), label1, label1 + length);
+                gc->ot_queued = true;
+                if (queued0.size() >= INPUT_OT_QUEUE_SIZE) flush_input_ot();
             }
 		}
 	}
 
-    // label is the 0-th label of garbler corresponding to b
+    // label is the 0-th label of garbler corresponding to b. The LSBs
+    // (permutation bits) of all labels that are not public are packed eight
+    // to a byte and exchanged in one message each way.
 	void reveal(bool* b, int party, const Label * label, int length) {
+        flush_input_ot();
+        std::vector<uint8_t> lsbs((length + 7) / 8, 0);
+        std::vector<int> secret;
 		for (int i = 0; i < length; ++i) {
             // If the label is public, no communication needed
 			if(isOne(&label[i]))
@@ -91,43 +127,87 @@ public:
 			else if (isZero(&label[i]))
 				b[i] = false;
 			else {
-				bool lsb = getLSB(label[i].lo), tmp;
-                // If the value is to be revealed to BOB or if it has to be made public,
-                // send the LSB (permutation-bit) of label to evaluator.
-				if (party == BOB or party == PUBLIC) {
-					io->send_data(&lsb, 1, true);
-				}
-                // If the value is revealed to ALICE or if it has to be made public,
-                // receive the LSB (permutation-bit) of the evaluator's label.
-                // If it matches with the LSB of label, then b = 0, else b = 1
-                if(party == ALICE || party == PUBLIC) {
-					io->recv_data(&tmp, 1, true);
-					b[i] = (tmp != lsb);
-				}
+                int k = secret.size();
+                lsbs[k / 8] |= getLSB(label[i].lo) << (k % 8);
+                secret.push_back(i);
 			}
 		}
+        if (secret.empty()) return;
+        int num_bytes = (secret.size() + 7) / 8;
+        // If the value is to be revealed to BOB or if it has to be made public,
+        // send the LSBs of the labels to evaluator.
+        if (party == BOB or party == PUBLIC) {
+            io->send_data(lsbs.data(), num_bytes, true);
+        }
+        // If the value is revealed to ALICE or if it has to be made public,
+        // receive the LSBs of the evaluator's labels.
+        // If one matches with the LSB of label, then b = 0, else b = 1
+        if(party == ALICE || party == PUBLIC) {
+            std::vector<uint8_t> other(num_bytes);
+            io->recv_data(other.data(), num_bytes, true);
+            for(size_t k = 0; k < secret.size(); k++) {
+                b[secret[k]] = ((other[k / 8] ^ lsbs[k / 8]) >> (k % 8)) & 1;
+            }
+        }
 	}
 
     void do_batched_ot() {
         assert(batched_ot == true);
         // Peform counter OTs together
-        mpz_t* temp0 = new mpz_t[counter];
-        mpz_t* temp1 = new mpz_t[counter];
-        for(int i = 0; i < counter; i++) {
-            mpz_inits(temp0[i], temp1[i], NULL);
-            mpz_import(temp0[i], 2, 1, sizeof(block), 0, 0, labels0 + i);
-            mpz_import(temp1[i], 2, 1, sizeof(block), 0, 0, labels1 + i);
-        }
-        ot->send_ot(temp0, temp1, counter, LABEL_BITLEN);
-        // Cleanup
-        for (int i = 0; i < counter; i++) {
-            mpz_clears(temp0[i], temp1[i], NULL);
-        }
-        delete[] temp0;
-        delete[] temp1;
+        send_label_ot(labels0, labels1, counter);
         // Turn batched_ot mode off
         batched_ot = false;
     }
+
+    // The garbler knows both labels of every input, so the garbled tables do
+    // not depend on the OTs, which run in the background on ot_io
+    void start_batched_ot() {
+        if(ot_io == nullptr) {
+            do_batched_ot();
+            return;
+        }
+        assert(batched_ot == true);
+        int length = counter;
+        pending_ot = std::async(std::launch::async, [this, length]() {
+            send_label_ot(labels0, labels1, length);
+        });
+        batched_ot = false;
+    }
+
+    void wait_batched_ot() {
+        if(pending_ot.valid()) pending_ot.get();
+    }
+
+    // Run the OTs of the queued evaluator inputs, after the batch started by
+    // start_batched_ot, which uses the same OT state
+    void flush_input_ot() {
+        wait_batched_ot();
+        gc->ot_queued = false;
+        if (queued0.empty()) return;
+        send_label_ot(queued0.data(), queued1.data(), queued0.size());
+        queued0.clear();
+        queued1.clear();
+    }
+
+    // Precompute random OTs for num_ot evaluator input labels in the offline phase
+    void precompute_ot(int num_ot) {
+        if(ot != nullptr) ot->precompute_rot(num_ot, LABEL_BITLEN);
+    }
+
+    // Send either label0 or label1 to the evaluator using OT extension if
+    // enabled, precomputed random OTs if enough are left, or PQ-OT otherwise
+    void send_label_ot(const Label* label0, const Label* label1, int length) {
+        if(ote != nullptr) {
+            ote->send_ot(label0, label1, length);
+            return;
+        }
+        if(ot->rot_available(LABEL_BITLEN) >= (uint64_t) length) {
+            ot->send_ot_precomputed((const uint8_t*) label0, (const uint8_t*) label1,
+                    length, LABEL_BITLEN);
+        } else {
+            ot->send_ot(label0, label1, length);
+        }
+    }
 };
 }
 #endif //SEMIHONEST_GEN_H__
@@ -4,15 +4,16 @@
 #include "pq-yao/semihonest-eva.h"
 
 namespace emp {
-inline void setup_semi_honest(NetIO* io, int party, int num_inputs = 0) {
+inline void setup_semi_honest(IOChannel* io, int party, int num_inputs = 0,
+        bool ot_extension = false, KeyStore* key_store = nullptr, IOChannel* ot_io = nullptr) {
 	if(party == ALICE) {
-		GateGen<NetIO> * t = new GateGen<NetIO>(io);
+		GateGen<IOChannel> * t = new GateGen<IOChannel>(io);
 		CircuitExecution::circ_exec = t;
-		ProtocolExecution::prot_exec = new SemiHonestGen(io, t, num_inputs);
+		ProtocolExecution::prot_exec = new SemiHonestGen(io, t, num_inputs, ot_extension, key_store, ot_io);
 	} else {
-		GateEva<NetIO> * t = new GateEva<NetIO>(io);
+		GateEva<IOChannel> * t = new GateEva<IOChannel>(io);
 		CircuitExecution::circ_exec = t;
-		ProtocolExecution::prot_exec = new SemiHonestEva(io, t, num_inputs);
+		ProtocolExecution::prot_exec = new SemiHonestEva(io, t, num_inputs, ot_extension, key_store, ot_io);
 	}
 }
 }
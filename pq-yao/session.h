@@ -0,0 +1,162 @@
+#ifndef SESSION_H__
+#define SESSION_H__
+#ifndef THREADING
+#error "pq-yao/session.h needs the THREADING build option"
+#endif
+#include "pq-yao/semihonest-gen.h"
+#include "pq-yao/semihonest-eva.h"
+#include "pq-ot/worker-pool.h"
+#include <functional>
+#include <vector>
+#include <netinet/in.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+namespace emp {
+// One 2PC session: the connection to the other party with the garbling and
+// the OT state of the semi-honest protocol, like setup_semi_honest sets up.
+// Circuits run in the session bound to the calling thread, so that with
+// THREADING several threads can each run their own session at the same time.
+// Takes ownership of io and ot_io.
+class Session {
+public:
+    int party;
+    IOChannel* io;
+    IOChannel* ot_io;
+    CircuitExecution* circ_exec;
+    ProtocolExecution* prot_exec;
+
+    Session(IOChannel* io, int party, int num_inputs = 0, bool ot_extension = false,
+            KeyStore* key_store = nullptr, IOChannel* ot_io = nullptr) {
+        this->party = party;
+        this->io = io;
+        this->ot_io = ot_io;
+        if(party == ALICE) {
+            GateGen<IOChannel>* t = new GateGen<IOChannel>(io);
+            circ_exec = t;
+            prot_exec = new SemiHonestGen(io, t, num_inputs, ot_extension, key_store, ot_io);
+        } else {
+            GateEva<IOChannel>* t = new GateEva<IOChannel>(io);
+            circ_exec = t;
+            prot_exec = new SemiHonestEva(io, t, num_inputs, ot_extension, key_store, ot_io);
+        }
+    }
+
+    ~Session() {
+        unbind();
+        delete prot_exec;
+        delete circ_exec;
+        delete ot_io;
+        delete io;
+    }
+
+    // Run the circuits of the calling thread in this session
+    void bind() {
+        CircuitExecution::circ_exec = circ_exec;
+        ProtocolExecution::prot_exec = prot_exec;
+    }
+
+    // Leave the calling thread without a session, if it is bound to this one
+    void unbind() {
+        if(CircuitExecution::circ_exec == circ_exec) {
+            CircuitExecution::circ_exec = nullptr;
+            ProtocolExecution::prot_exec = nullptr;
+        }
+    }
+};
+
+// Accepts clients on a port and runs a session with each of them on a shared
+// pool of threads, so that one process serves many clients. A thread runs one
+// session at a time, bound to it, and clients beyond the number of threads
+// wait for a free one.
+class SessionServer {
+public:
+    // Runs the circuits of a session, whose inputs are the server's
+    typedef std::function<void(Session&)> Handler;
+
+    SessionServer(int port, int num_threads, Handler handler, int party = ALICE,
+            int num_inputs = 0, bool ot_extension = false) {
+        this->handler = handler;
+        this->party = party;
+        this->num_inputs = num_inputs;
+        this->ot_extension = ot_extension;
+        struct sockaddr_in serv;
+        memset(&serv, 0, sizeof(serv));
+        serv.sin_family = AF_INET;
+        serv.sin_addr.s_addr = htonl(INADDR_ANY);
+        serv.sin_port = htons(port);
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(listener, SOL_SOCKET, SO_REUSEADDR, (const char*)&reuse, sizeof(reuse));
+        if(::bind(listener, (struct sockaddr *)&serv, sizeof(struct sockaddr)) < 0) {
+            perror("error: bind");
+            exit(1);
+        }
+        if(listen(listener, SOMAXCONN) < 0) {
+            perror("error: listen");
+            exit(1);
+        }
+        pool = new WorkerPool(num_threads);
+    }
+
+    ~SessionServer() {
+        delete pool;
+        close(listener);
+    }
+
+    // Accepts num_clients clients, and returns once all their sessions are done
+    void serve(int num_clients) {
+        std::vector<SessionJob*> jobs;
+        for(int i = 0; i < num_clients; i++) {
+            int socket = accept(listener, nullptr, nullptr);
+            if(socket < 0) {
+                perror("error: accept");
+                break;
+            }
+            SessionJob* job = new SessionJob(this, socket);
+            jobs.push_back(job);
+            pool->submit(job);
+        }
+        for(SessionJob* job : jobs) {
+            job->wait();
+            delete job;
+        }
+    }
+
+private:
+    class SessionJob: public Job {
+    public:
+        SessionJob(SessionServer* server, int socket) {
+            this->server = server;
+            this->socket = socket;
+        }
+
+        void run() {
+            // The session's PQOT picks its per-thread SEAL objects by the
+            // index of the calling thread in a worker pool, which would be
+            // the index in the server's pool here
+            int worker = WorkerPool::current_worker();
+            WorkerPool::current_worker() = -1;
+            {
+                Session session(new NetIO(socket, true),
+                        server->party, server->num_inputs, server->ot_extension);
+                session.bind();
+                server->handler(session);
+            }
+            WorkerPool::current_worker() = worker;
+        }
+
+    private:
+        SessionServer* server;
+        int socket;
+    };
+
+    Handler handler;
+    int party;
+    int num_inputs;
+    bool ot_extension;
+    int listener;
+    WorkerPool* pool;
+};
+}
+#endif// SESSION_H__
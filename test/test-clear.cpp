@@ -0,0 +1,77 @@
+#include <typeinfo>
+#include "emp-tool/emp-tool.h"
+using namespace emp;
+using namespace std;
+
+ClearCircuitExecution* clear;
+
+// Runs Op2 on 64 pairs of inputs at once and checks every instance against Op
+template<typename Op, typename Op2>
+void test_int(int runs = 10) {
+	PRG prg(fix_key);
+	for(int i = 0; i < runs; ++i) {
+		uint64_t ia[64], ib[64], words_a[32], words_b[32], words_res[32], res[64];
+		for(int k = 0; k < 64; ++k) {
+			int32_t x, y;
+			prg.random_data(&x, 4);
+			prg.random_data(&y, 4);
+			x %= 1 << 24;
+			y %= 1 << 24;
+			if (y == 0) y = 1;
+			ia[k] = (uint32_t) x;
+			ib[k] = (uint32_t) y;
+		}
+		slice_values(words_a, ia, 32);
+		slice_values(words_b, ib, 32);
+		Integer a(32, (long long) 0, PUBLIC);
+		Integer b(32, (long long) 0, PUBLIC);
+		feed_words(a.bits, words_a, 32);
+		feed_words(b.bits, words_b, 32);
+
+		Integer c = Op2()(a, b);
+
+		reveal_words(words_res, c.bits, 32);
+		unslice_values(res, words_res, 32);
+		for(int k = 0; k < 64; ++k) {
+			uint32_t expected = Op()((int32_t) ia[k], (int32_t) ib[k]);
+			assert(res[k] == expected && "Failed Operation");
+		}
+	}
+	cout << typeid(Op2).name()<<"\t\t\tDONE"<<endl;
+}
+
+int main(int argc, char** argv) {
+	int runs = 10;
+	if (argc >= 2) runs = atoi(argv[1]);
+	clear = setup_clear();
+
+	test_int<std::plus<int>, std::plus<Integer>>(runs);
+	test_int<std::minus<int>, std::minus<Integer>>(runs);
+	test_int<std::multiplies<int>, std::multiplies<Integer>>(runs);
+	test_int<std::divides<int>, std::divides<Integer>>(runs);
+	test_int<std::modulus<int>, std::modulus<Integer>>(runs);
+	test_int<std::bit_and<int>, std::bit_and<Integer>>(runs);
+	test_int<std::bit_xor<int>, std::bit_xor<Integer>>(runs);
+
+	// Inputs of a party go to every instance, and reveal shows the first
+	Float32 f(1.5, ALICE);
+	Float32 g(2.25, BOB);
+	assert((f * g).reveal<double>(PUBLIC) == 3.375 && "Failed Operation");
+
+	// Gates of one 32-bit multiplication, by call site
+	clear->reset();
+	Integer a(32, 3, ALICE);
+	Integer b(32, 5, BOB);
+	Integer c = a * b;
+	assert(c.reveal<int>(PUBLIC) == 15 && "Failed Operation");
+	clear->print_sites(stdout, 5);
+
+	clear->count_sites = false;
+	auto time_start = clock_start();
+	for(int i = 0; i < runs * 100; ++i) {
+		c = c * b;
+	}
+	double time_mult = time_from(time_start);
+	cout << "32-bit multiplications per second: " << runs * 100 * 64 / (time_mult / 1e6) << endl;
+	cout << "Successful Operation" << endl;
+}
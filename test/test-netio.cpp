@@ -0,0 +1,88 @@
+#include "emp-tool/emp-tool.h"
+
+using namespace std;
+using namespace emp;
+
+int party;
+int port;
+int num_mbytes = 1024;
+int buffer_kb = NETWORK_BUFFER_SIZE / 1024;
+
+// Transfers num_mbytes from ALICE to BOB in messages of msg_size bytes, sent
+// as plain buffered writes or as frames behind a 14-byte header, and checks
+// the last message. Frames sent with async take a fresh message each, which
+// the channel frees when it is done with it.
+void run(IOChannel* io, const char* name, size_t msg_size, bool frames, bool async = false) {
+    vector<uint8_t> data(msg_size);
+    char header[14] = {0};
+    uint64_t num_msgs = ((uint64_t) num_mbytes << 20) / msg_size;
+    io->sync();
+
+    auto time_start = clock_start();
+    for(uint64_t i = 0; i < num_msgs; i++) {
+        if (party == ALICE) {
+            data[0] = (uint8_t) i;
+            if (async) {
+                uint8_t* msg = new uint8_t[msg_size];
+                memcpy(msg, data.data(), msg_size);
+                io->send_frame_async(header, sizeof(header), msg, msg_size,
+                        [msg]() { delete[] msg; });
+            } else if (frames) io->send_frame(header, sizeof(header), data.data(), msg_size);
+            else io->send_data(data.data(), msg_size);
+        } else {
+            if (frames) io->recv_data(header, sizeof(header));
+            io->recv_data(data.data(), msg_size);
+        }
+    }
+    io->flush();
+    io->sync();
+    double time_transfer = time_from(time_start);
+    assert(data[0] == (uint8_t) (num_msgs - 1) && "Failed Operation");
+
+    cout << name << ": " << (num_msgs * msg_size >> 20) / (time_transfer / 1e6)
+        << " MB/s" << endl;
+}
+
+int main(int argc, char** argv) {
+    parse_party_and_port(argv, &party, &port);
+    if (argc >= 4) num_mbytes = atoi(argv[3]);
+    if (argc >= 5) buffer_kb = atoi(argv[4]);
+
+    cout << "Sending " << num_mbytes << " MB over loopback with "
+        << buffer_kb << " KB buffers" << endl;
+
+    NetIO* io = new NetIO(party == ALICE ? nullptr : "127.0.0.1", port,
+            (size_t) buffer_kb * 1024);
+    // Garbled tables, ciphertexts, and transfers larger than the buffers
+    run(io, "128-byte writes", 128, false);
+    run(io, "64 KB frames", 1 << 16, true);
+    run(io, "64 MB writes", 1 << 26, false);
+    // Full buffers and large frames without a copy. Over loopback, the
+    // kernel copies them after all.
+    if (io->set_zerocopy(true)) {
+        run(io, "zero-copy 128-byte writes", 128, false);
+        run(io, "zero-copy 1 MB frames", 1 << 20, true, true);
+        cout << "zero-copy: " << io->zerocopy_sends << " sends, "
+            << io->zerocopy_copied << " copied by the kernel" << endl;
+    } else {
+        cout << "MSG_ZEROCOPY not supported" << endl;
+    }
+    delete io;
+
+    // The same transfers through io_uring, on the next port
+    UringIO* uring_io = new UringIO(party == ALICE ? nullptr : "127.0.0.1", port + 1);
+    uint64_t enter_calls = uring_io->enter_calls();
+    run(uring_io, "io_uring 128-byte writes", 128, false);
+    run(uring_io, "io_uring 64 KB frames", 1 << 16, true);
+    run(uring_io, "io_uring 64 MB writes", 1 << 26, false);
+    // Frames sent with async go through the ring too
+    assert(!uring_io->set_zerocopy(true) && "Failed Operation");
+    run(uring_io, "io_uring 1 MB async frames", 1 << 20, true, true);
+    enter_calls = uring_io->enter_calls() - enter_calls;
+    delete uring_io;
+    cout << "io_uring: " << (double) enter_calls / (4 * num_mbytes)
+        << " io_uring_enter calls per MB" << endl;
+
+    cout << "Successful Operation" << endl;
+    return 0;
+}
@@ -0,0 +1,102 @@
+#include "pq-ot/pq-otmain.h"
+#include <thread>
+
+using namespace std;
+using namespace seal;
+using namespace seal::util;
+
+int num_iter = 100;
+int num_threads = 1;
+
+// Sampler used before the AES-CTR one: two 32-bit draws from a SEAL generator
+// per 64-bit word and a modular reduction per coefficient, kept as a baseline
+void sample_poly_coeffs_adapter(uint64_t *poly, uint32_t bitlen,
+        shared_ptr<UniformRandomGenerator> random,
+        shared_ptr<const SEALContext::ContextData> &context_data)
+{
+    auto &parms = context_data->parms();
+    auto &coeff_modulus = parms.coeff_modulus();
+    size_t coeff_count = parms.poly_modulus_degree();
+    size_t coeff_mod_count = coeff_modulus.size();
+    uint64_t bitlen_mask = (1ULL << (bitlen % 64)) - 1;
+
+    RandomToStandardAdapter engine(random);
+    for (size_t i = 0; i < coeff_count; i++) {
+        if (bitlen < 64) {
+            uint64_t noise = (uint64_t(engine()) << 32) | engine();
+            noise &= bitlen_mask;
+            for (size_t j = 0; j < coeff_mod_count; j++) {
+                poly[i + (j * coeff_count)] = noise % coeff_modulus[j].value();
+            }
+        } else {
+            uint64_t noise[2]; // LSB || MSB
+            noise[0] = (uint64_t(engine()) << 32) | engine();
+            noise[1] = (uint64_t(engine()) << 32) | engine();
+            noise[1] &= bitlen_mask;
+            for (size_t j = 0; j < coeff_mod_count; j++) {
+                poly[i + (j * coeff_count)] = barrett_reduce_128(noise, coeff_modulus[j]);
+            }
+        }
+    }
+}
+
+// Runs num_iter samplings on each of num_threads new threads, so thread_local
+// state is fresh for every run, and returns the time in microseconds
+template<typename F>
+double run_threads(F sample) {
+    auto time_start = emp::clock_start();
+    vector<thread> threads;
+    for(int t = 0; t < num_threads; t++) {
+        threads.emplace_back([&]() {
+            for(int i = 0; i < num_iter; i++) {
+                sample();
+            }
+        });
+    }
+    for(auto& t : threads) {
+        t.join();
+    }
+    return emp::time_from(time_start);
+}
+
+int main(int argc, char** argv){
+    if (argc >= 2) num_iter = atoi(argv[1]);
+    if (argc >= 3) num_threads = atoi(argv[2]);
+
+    cout << "Sampling " << num_iter << " flooding polynomials on each of "
+        << num_threads << " threads" << endl;
+
+    for(int p = 0; p < NUM_PARAM_SETS; p++) {
+        const PQOTParams& params = pqot_params[p];
+        Cryptosystem pkc(emp::ALICE, params.plain_modulus_bitlen, params.poly_degree);
+        // Flooding happens after the OT computation and, for the 33-bit set,
+        // one modulus switch
+        auto context_data = pkc.context->context_data();
+        if (params.plain_modulus_bitlen == 33) {
+            context_data = context_data->next_context_data();
+        }
+        size_t coeff_count = params.poly_degree;
+        size_t coeff_mod_count = context_data->parms().coeff_modulus().size();
+        uint32_t noise_len = 89 - params.plain_modulus_bitlen;
+        double num_coeffs = (double) num_iter * num_threads * coeff_count;
+
+        double time_adapter = run_threads([&]() {
+            thread_local vector<uint64_t> poly(coeff_count * coeff_mod_count);
+            thread_local shared_ptr<UniformRandomGenerator> random(
+                    context_data->parms().random_generator()->create());
+            sample_poly_coeffs_adapter(poly.data(), noise_len, random, context_data);
+        });
+        double time_prg = run_threads([&]() {
+            thread_local vector<uint64_t> poly(coeff_count * coeff_mod_count);
+            thread_local emp::PRG prg;
+            sample_poly_coeffs_uniform(poly.data(), noise_len, prg, context_data);
+        });
+
+        cout << "poly_degree " << params.poly_degree << ", " << coeff_mod_count
+            << " moduli, " << noise_len << "-bit noise" << endl;
+        cout << "  Adapter Sampler: " << time_adapter * 1000 / num_coeffs << " ns/coeff" << endl;
+        cout << "  AES-CTR Sampler: " << time_prg * 1000 / num_coeffs << " ns/coeff" << endl;
+        cout << "  Speedup: " << time_adapter / time_prg << "x" << endl;
+    }
+    return 0;
+}
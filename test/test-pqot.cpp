@@ -9,7 +9,11 @@ int num_threads = 1;
 int num_ot = (1 << 17);
 int bitlen = 256;
 int plain_modulus_bitlen = 17;
+bool precompute = false;
 string address = "127.0.0.1";
+string key_store_dir = "";
+int num_sockets = 1;
+string wan = "";
 
 int main(int argc, char** argv){
 	parse_party_and_port(argv, &role, &port);
@@ -17,6 +21,11 @@ int main(int argc, char** argv){
     if (argc >= 5) num_ot = atoi(argv[4]);
     if (argc >= 6) bitlen = atoi(argv[5]);
     if (argc >= 7) num_threads = atoi(argv[6]);
+    if (argc >= 8) precompute = atoi(argv[7]);
+    if (argc >= 9) plain_modulus_bitlen = atoi(argv[8]);
+    if (argc >= 10) key_store_dir = argv[9];
+    if (argc >= 11) num_sockets = atoi(argv[10]);
+    if (argc >= 12) wan = argv[11];
 
     cout << "Performing " << num_ot << " 1oo2 OTs on " << bitlen
         << "-bit messages with " << num_threads << " threads" << endl;
@@ -24,8 +33,34 @@ int main(int argc, char** argv){
     chrono::high_resolution_clock::time_point time_start, time_end;
 
     time_start = chrono::high_resolution_clock::now();
-    NetIO* io = new NetIO(role == ALICE ? NULL : address.c_str(), port);
-    PQOT ot(io, role, num_threads, plain_modulus_bitlen);
+    // Address "shm" connects through shared memory on this host,
+    // "uring:<address>" through io_uring, and "zerocopy:<address>" sends
+    // large messages with MSG_ZEROCOPY
+    auto connect = [&](int port) -> IOChannel* {
+        if (address == "shm") return new SharedMemIO(role == ALICE ? NULL : "", port);
+        if (address.compare(0, 6, "uring:") == 0) {
+            return new UringIO(role == ALICE ? NULL : address.c_str() + 6, port);
+        }
+        if (address.compare(0, 9, "zerocopy:") == 0) {
+            NetIO* net_io = new NetIO(role == ALICE ? NULL : address.c_str() + 9, port);
+            if (!net_io->set_zerocopy(true)) cout << "MSG_ZEROCOPY not supported" << endl;
+            return net_io;
+        }
+        return new NetIO(role == ALICE ? NULL : address.c_str(), port);
+    };
+    // Each connection behind its own emulated link, if one is given
+    auto connect_link = [&](int port) -> IOChannel* {
+        IOChannel* io = connect(port);
+        if (wan.empty()) return io;
+        return new WanIO(io, wan.c_str());
+    };
+    IOChannel* io = connect_link(port);
+    // Extra connections on the next ports, striping the OT channels
+    vector<IOChannel*> ios = {io};
+    for(int i = 1; i < num_sockets; i++) {
+        ios.push_back(connect_link(port + i));
+    }
+    PQOT ot(ios, role, num_threads, plain_modulus_bitlen);
     time_end = chrono::high_resolution_clock::now();
 
     chrono::microseconds time_context = chrono::duration_cast<
@@ -33,16 +68,23 @@ int main(int argc, char** argv){
 
     cout << "Context Initialization Time: " << time_context.count() << " microseconds" << endl;
 
+    // Keys stored by earlier runs with the same peer are reused
+    KeyStore* key_store = nullptr;
+    if (!key_store_dir.empty()) {
+        key_store = new KeyStore(key_store_dir, address);
+        ot.set_key_store(key_store);
+    }
+
     io->sync();
 
-    uint64_t keygen_comm_start = io->get_total_comm();
+    uint64_t keygen_comm_start = ot.get_total_comm();
     time_start = chrono::high_resolution_clock::now();
 
     // Keygen
     ot.keygen();
 
     time_end = chrono::high_resolution_clock::now();
-    uint64_t keygen_comm_end = io->get_total_comm();
+    uint64_t keygen_comm_end = ot.get_total_comm();
     uint64_t keygen_comm = keygen_comm_end - keygen_comm_start;
 
     chrono::microseconds time_keygen = chrono::duration_cast<
@@ -51,6 +93,10 @@ int main(int argc, char** argv){
     cout << "KeyGen Time: " << time_keygen.count() << " microseconds" << endl;
     cout << "Keygen Comm: " << keygen_comm << " bytes" << endl;
 
+    const PQOTParams& params = pqot_params[ot.param_set(num_ot, bitlen)];
+    cout << "HE Parameters: poly_degree " << params.poly_degree
+        << ", plain_modulus_bitlen " << params.plain_modulus_bitlen << endl;
+
     // Oblivious Transfer
     mpz_t *m_0, *m_1;
     gmp_randstate_t state;
@@ -75,17 +121,42 @@ int main(int argc, char** argv){
 
     io->sync();
 
-    uint64_t circuit_comm_start = io->get_total_comm();
+    if (precompute) {
+        uint64_t offline_comm_start = ot.get_total_comm();
+        time_start = chrono::high_resolution_clock::now();
+
+        // Random OTs independent of the messages and choice bits
+        ot.precompute_rot(num_ot, bitlen);
+
+        time_end = chrono::high_resolution_clock::now();
+        uint64_t offline_comm = ot.get_total_comm() - offline_comm_start;
+
+        chrono::microseconds time_offline = chrono::duration_cast<
+        chrono::microseconds>(time_end - time_start);
+
+        cout << "Offline Time: " << time_offline.count() << " microseconds" << endl;
+        cout << "Offline Comm: " << offline_comm << " bytes" << endl;
+
+        io->sync();
+    }
+
+    uint64_t circuit_comm_start = ot.get_total_comm();
     time_start = chrono::high_resolution_clock::now();
 
-    if (role == ALICE) {
+    if (precompute) {
+        if (role == ALICE) {
+            ot.send_ot_precomputed(m_0, m_1, num_ot, bitlen);
+        } else { // role == BOB
+            ot.recv_ot_precomputed(m_0, b, num_ot, bitlen);
+        }
+    } else if (role == ALICE) {
         ot.send_ot(m_0, m_1, num_ot, bitlen);
     } else { // role == BOB
         ot.recv_ot(m_0, b, num_ot, bitlen);
     }
 
     time_end = chrono::high_resolution_clock::now();
-    uint64_t circuit_comm_end = io->get_total_comm();
+    uint64_t circuit_comm_end = ot.get_total_comm();
     uint64_t circuit_comm = circuit_comm_end - circuit_comm_start;
 
     chrono::microseconds time_circuit = chrono::duration_cast<
@@ -109,5 +180,6 @@ int main(int argc, char** argv){
     assert(flag == true && "Failed Operation");
     cout << "Successful Operation" << endl;
 
+    delete key_store;
     return 0;
 }
@@ -0,0 +1,82 @@
+#include "pq-ot/ot-extension.h"
+
+using namespace std;
+using namespace emp;
+
+int role;
+int port;
+int num_threads = 1;
+int num_ot = (1 << 20);
+string address = "127.0.0.1";
+
+int main(int argc, char** argv){
+	parse_party_and_port(argv, &role, &port);
+    if (argc >= 4) address = argv[3];
+    if (argc >= 5) num_ot = atoi(argv[4]);
+    if (argc >= 6) num_threads = atoi(argv[5]);
+
+    cout << "Extending " << num_ot << " 1oo2 OTs on " << LABEL_BITLEN
+        << "-bit messages from " << OTE_KAPPA << " base OTs" << endl;
+
+    NetIO* io = new NetIO(role == ALICE ? NULL : address.c_str(), port);
+    PQOTExtension ote(io, role, num_threads);
+
+    io->sync();
+
+    uint64_t setup_comm_start = io->get_total_comm();
+    auto time_start = clock_start();
+
+    // Base OTs
+    ote.setup();
+
+    double time_setup = time_from(time_start);
+    uint64_t setup_comm = io->get_total_comm() - setup_comm_start;
+
+    cout << "Base OT Time: " << time_setup << " microseconds" << endl;
+    cout << "Base OT Comm: " << setup_comm << " bytes" << endl;
+
+    // Oblivious Transfer
+    PRG prg(fix_key);
+    Label *m_0 = new Label[num_ot];
+    Label *m_1 = new Label[num_ot];
+    bool *b = new bool[num_ot];
+    prg.random_label(m_0, num_ot);
+    prg.random_label(m_1, num_ot);
+    prg.random_bool(b, num_ot);
+
+    io->sync();
+
+    uint64_t ext_comm_start = io->get_total_comm();
+    time_start = clock_start();
+
+    Label *m_b = new Label[num_ot];
+    if (role == ALICE) {
+        ote.send_ot(m_0, m_1, num_ot);
+    } else { // role == BOB
+        ote.recv_ot(m_b, b, num_ot);
+    }
+
+    double time_ext = time_from(time_start);
+    uint64_t ext_comm = io->get_total_comm() - ext_comm_start;
+
+    cout << "Extension Time: " << time_ext << " microseconds" << endl;
+    cout << "Extension Comm: " << ext_comm << " bytes" << endl;
+
+    // Both parties derive the same messages from fix_key, so the OT Receiver
+    // can check its outputs locally
+    if (role == BOB) {
+        for(int i = 0; i < num_ot; i++) {
+            const Label& expected = b[i] ? m_1[i] : m_0[i];
+            assert(cmpBlock((block*) &expected, (block*) &m_b[i], 2) && "Failed Operation");
+        }
+    }
+    io->sync();
+    cout << "Successful Operation" << endl;
+
+    delete[] m_0;
+    delete[] m_1;
+    delete[] m_b;
+    delete[] b;
+    delete io;
+    return 0;
+}
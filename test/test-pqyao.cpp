@@ -8,9 +8,15 @@ int port, party;
 string file = circuit_file_location;
 int n_inputs, n_outputs;
 int num_iter = 100;
+bool ot_extension = false;
+bool precompute = false;
+bool async_ot = false;
+string wan = "";
+string transcript = "";
 string circuit = "aes";
 CircuitFile* cf;
-NetIO* io;
+IOChannel* io;
+IOChannel* ot_io = nullptr;
 double time_send_input, time_ot_input, time_circuit, time_input, time_total;
 uint64_t comm_send_input, comm_ot_input, comm_circuit, comm_input, comm_total;
 
@@ -29,6 +35,15 @@ void test() {
     io->sync();
     uint64_t comm_start = io->get_total_comm();
 	auto time_start = clock_start();
+    if (precompute) {
+        // Random OTs for the evaluator's inputs, independent of the inputs
+        ProtocolExecution::prot_exec->precompute_ot(n_inputs * num_iter);
+        cout << "Time Offline: " << time_from(time_start) << endl;
+        cout << "Comm Offline: " << io->get_total_comm() - comm_start << endl;
+        io->sync();
+        comm_start = io->get_total_comm();
+        time_start = clock_start();
+    }
 	Integer a(n_inputs * num_iter, 16807, ALICE);
 	Integer b(n_inputs * num_iter, 282475249, BOB);
 	Integer c(n_outputs * num_iter, (long long) 0, PUBLIC);
@@ -38,7 +53,12 @@ void test() {
     io->sync();
     comm_start = io->get_total_comm();
     time_start = clock_start();
-    ProtocolExecution::prot_exec->do_batched_ot();
+    if (async_ot) {
+        // OTs run on ot_io while the circuit is garbled
+        ProtocolExecution::prot_exec->start_batched_ot();
+    } else {
+        ProtocolExecution::prot_exec->do_batched_ot();
+    }
     time_ot_input = time_from(time_start);
     comm_ot_input = io->get_total_comm() - comm_start;
 
@@ -50,15 +70,20 @@ void test() {
     io->sync();
     comm_start = io->get_total_comm();
     time_start = clock_start();
+    // An input fed after the batch, whose OT is queued and runs before the
+    // first gate, once the batch is done
+    Integer extra(32, 12345, BOB);
 	for(int i = 0; i < num_iter; ++i) {
         cf->compute(c.bits, a.bits, b.bits);
 	}
+    ProtocolExecution::prot_exec->wait_batched_ot();
     time_circuit = time_from(time_start);
     comm_circuit = io->get_total_comm() - comm_start;
     cout << "Time Circuit: " << time_circuit << endl;
     cout << "Comm Circuit: " << comm_circuit << endl;
 
     string output = c.reveal<string>(PUBLIC);
+    assert((extra + extra).reveal<int>(PUBLIC) == 24690 && "Failed Operation");
     time_total = time_input + time_circuit;
     comm_total = comm_input + comm_circuit;
 	cout << "Time Total: " << time_total << endl;
@@ -83,10 +108,32 @@ void test() {
 
 int main(int argc, char** argv) {
 	parse_party_and_port(argv, &party, &port);
-	io = new NetIO(party==ALICE?nullptr:"127.0.0.1", port);
 
     if (argc >= 4) circuit = argv[3];
     if (argc >= 5) num_iter = atoi(argv[4]);
+    if (argc >= 6) ot_extension = atoi(argv[5]);
+    if (argc >= 7) precompute = atoi(argv[6]);
+    if (argc >= 8) async_ot = atoi(argv[7]);
+    if (argc >= 9) wan = argv[8];
+    if (argc >= 10) transcript = argv[9];
+    // "record:<file>" writes the transcript of this party to <file>.<party>,
+    // and "replay:<file>" runs this party alone from that transcript. Both
+    // fix the seed of the PRGs, so that the replayed party repeats its run.
+    string mode = transcript.substr(0, transcript.find(':') + 1);
+    string trace_file = transcript.substr(mode.size()) + "." + to_string(party);
+    if (mode == "record:" || mode == "replay:") {
+        PRG::set_default_seed(makeBlock(0, party));
+    }
+    // Both connections behind their own emulated link, if one is given
+    auto connect = [&](int port) -> IOChannel* {
+        string path = trace_file + ((port == ::port) ? "" : ".ot");
+        if (mode == "replay:") return new ReplayIO(path.c_str());
+        IOChannel* net_io = new NetIO(party==ALICE?nullptr:"127.0.0.1", port);
+        if (!wan.empty()) net_io = new WanIO(net_io, wan.c_str());
+        if (mode == "record:") net_io = new RecordIO(net_io, path.c_str());
+        return net_io;
+    };
+	io = connect(port);
 
     switch(map_case(circuit)){
         case 0:
@@ -112,8 +159,18 @@ int main(int argc, char** argv) {
         << n_inputs << "-bit inputs and " << n_outputs << "-bit outputs" << endl;
 
     cf = new CircuitFile(file.c_str());
-	setup_semi_honest(io, party, n_inputs * num_iter);
+    // Asynchronous OTs need their own connection, on the next port
+    if (async_ot) {
+        ot_io = connect(port + 1);
+    }
+	setup_semi_honest(io, party, n_inputs * num_iter, ot_extension, nullptr, ot_io);
 	test();
+    if (mode == "replay:") {
+        uint64_t divergence = ((ReplayIO*) io)->divergence;
+        if (divergence == UINT64_MAX) cout << "Sent data matches the transcript" << endl;
+        else cout << "Sent data differs from the transcript at byte " << divergence << endl;
+    }
 
 	delete io;
+    delete ot_io;
 }
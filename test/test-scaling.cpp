@@ -0,0 +1,71 @@
+#include "pq-ot/pq-ot.h"
+
+using namespace std;
+using namespace emp;
+
+int role;
+int port;
+int max_threads = 64;
+int num_ot = (1 << 16);
+int bitlen = 256;
+int plain_modulus_bitlen = 17;
+string address = "127.0.0.1";
+
+int main(int argc, char** argv){
+	parse_party_and_port(argv, &role, &port);
+    if (argc >= 4) address = argv[3];
+    if (argc >= 5) num_ot = atoi(argv[4]);
+    if (argc >= 6) bitlen = atoi(argv[5]);
+    if (argc >= 7) max_threads = atoi(argv[6]);
+    if (argc >= 8) plain_modulus_bitlen = atoi(argv[7]);
+
+    cout << "Performing " << num_ot << " 1oo2 OTs on " << bitlen
+        << "-bit messages with 1 to " << max_threads << " threads" << endl;
+
+    NetIO* io = new NetIO(role == ALICE ? NULL : address.c_str(), port);
+
+    // Oblivious Transfer inputs, shared by every thread count
+    mpz_t *m_0, *m_1;
+    gmp_randstate_t state;
+    gmp_randinit_mt(state);
+    bool* b = new bool[num_ot];
+    m_0 = new mpz_t[num_ot];
+    m_1 = new mpz_t[num_ot];
+    for(int i = 0; i < num_ot; i++){
+        mpz_inits(m_0[i], m_1[i], NULL);
+        mpz_urandomb(m_0[i], state, bitlen);
+        mpz_urandomb(m_1[i], state, bitlen);
+        b[i] = rand() & 1;
+    }
+
+    for(int num_threads = 1; num_threads <= max_threads; num_threads *= 2) {
+        PQOT ot(io, role, num_threads, plain_modulus_bitlen);
+        ot.keygen();
+        io->sync();
+
+        auto time_start = clock_start();
+        if (role == ALICE) {
+            ot.send_ot(m_0, m_1, num_ot, bitlen);
+        } else { // role == BOB
+            ot.recv_ot(m_0, b, num_ot, bitlen);
+        }
+        double time_ot = time_from(time_start);
+
+        cout << "Threads " << num_threads << ": "
+            << (uint64_t) (num_ot / (time_ot / 1e6)) << " OTs/s, "
+            << "Lock Wait " << ot.lock_wait_time() << " microseconds" << endl;
+
+        bool flag = (role == ALICE) ? ot.verify(m_0, m_1, num_ot) : ot.verify(m_0, b, num_ot);
+        assert(flag == true && "Failed Operation");
+    }
+    cout << "Successful Operation" << endl;
+
+    for(int i = 0; i < num_ot; i++){
+        mpz_clears(m_0[i], m_1[i], NULL);
+    }
+    delete[] m_0;
+    delete[] m_1;
+    delete[] b;
+    delete io;
+    return 0;
+}
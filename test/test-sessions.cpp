@@ -0,0 +1,58 @@
+#include "pq-yao/emp-sh2pc.h"
+#include "pq-yao/session.h"
+#include <atomic>
+#include <thread>
+
+using namespace emp;
+using namespace std;
+
+int port, party;
+int num_clients = 8;
+int num_threads = 4;
+const long long server_input = 16807;
+
+// The server multiplies its input with the input of each client, which is
+// the index of the client plus one
+void serve_session(Session& session) {
+    Integer a(32, server_input, ALICE);
+    Integer b(32, (long long) 0, BOB);
+    Integer c = a * b;
+    c.reveal<int>(PUBLIC);
+}
+
+int main(int argc, char** argv) {
+	parse_party_and_port(argv, &party, &port);
+    if (argc >= 4) num_clients = atoi(argv[3]);
+    if (argc >= 5) num_threads = atoi(argv[4]);
+
+    if (party == ALICE) {
+        cout << "Serving " << num_clients << " sessions on " << num_threads << " threads" << endl;
+        SessionServer server(port, num_threads, serve_session);
+        auto time_start = clock_start();
+        server.serve(num_clients);
+        double time_total = time_from(time_start);
+        cout << "Time Total: " << time_total << endl;
+        cout << "Sessions per second: " << num_clients / (time_total / 1e6) << endl;
+        cout << "Successful Operation" << endl;
+        return 0;
+    }
+
+    // Every client runs its own session on its own thread and connection
+    atomic<int> failed{0};
+    vector<thread> clients;
+    for(int i = 0; i < num_clients; i++) {
+        clients.emplace_back([i, &failed]() {
+            Session session(new NetIO("127.0.0.1", port), BOB);
+            session.bind();
+            Integer a(32, (long long) 0, ALICE);
+            Integer b(32, i + 1, BOB);
+            Integer c = a * b;
+            if (c.reveal<int>(PUBLIC) != server_input * (i + 1)) failed++;
+        });
+    }
+    for(thread& client : clients) {
+        client.join();
+    }
+    assert(failed == 0 && "Failed Operation");
+    cout << "Successful Operation" << endl;
+}
@@ -0,0 +1,67 @@
+#include "emp-tool/emp-tool.h"
+
+using namespace std;
+using namespace emp;
+
+int party;
+int port;
+int num_mbytes = 256;
+int chunk = 4096;
+int num_round_trips = 10000;
+
+// Streams num_mbytes from ALICE to BOB in chunks, then times round trips of
+// one byte each
+void run(const char* name, IOChannel* io) {
+    vector<uint8_t> data(chunk), expected(chunk);
+    uint64_t total = (uint64_t) num_mbytes << 20;
+    io->sync();
+
+    auto time_start = clock_start();
+    for(uint64_t sent = 0; sent < total; sent += chunk) {
+        if (party == ALICE) {
+            memset(data.data(), (uint8_t) (sent / chunk), chunk);
+            io->send_data(data.data(), chunk);
+        } else {
+            io->recv_data(data.data(), chunk);
+            memset(expected.data(), (uint8_t) (sent / chunk), chunk);
+            assert(memcmp(data.data(), expected.data(), chunk) == 0 && "Failed Operation");
+        }
+    }
+    io->flush();
+    io->sync();
+    double time_stream = time_from(time_start);
+
+    time_start = clock_start();
+    uint8_t byte = 0;
+    for(int i = 0; i < num_round_trips; i++) {
+        if (party == ALICE) {
+            io->send_data(&byte, 1);
+            io->recv_data(&byte, 1);
+        } else {
+            io->recv_data(&byte, 1);
+            io->send_data(&byte, 1);
+            io->flush();
+        }
+    }
+    double time_rtt = time_from(time_start);
+
+    cout << name << ": " << num_mbytes / (time_stream / 1e6) << " MB/s, "
+        << time_rtt / num_round_trips << " microseconds per round trip" << endl;
+}
+
+int main(int argc, char** argv) {
+    parse_party_and_port(argv, &party, &port);
+    if (argc >= 4) num_mbytes = atoi(argv[3]);
+    if (argc >= 5) chunk = atoi(argv[4]);
+
+    NetIO* net_io = new NetIO(party == ALICE ? nullptr : "127.0.0.1", port);
+    run("NetIO", net_io);
+    delete net_io;
+
+    SharedMemIO* shm_io = new SharedMemIO(party == ALICE ? nullptr : "127.0.0.1", port);
+    run("SharedMemIO", shm_io);
+    delete shm_io;
+
+    cout << "Successful Operation" << endl;
+    return 0;
+}